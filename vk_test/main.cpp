@@ -4,20 +4,52 @@
 #include <stdexcept>
 #include <vector>
 #include <functional>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <memory>
 
 #include "spirv_msl.hpp"
 #include "vk_scoped_object.h"
 #include "vk_memory_allocator.h"
 #include "vk_memory_manager.h"
+#include "vk_memory_copy.h"
 #include "vk_shader_manager.h"
 #include "vk_descriptor_manager.h"
 #include "vk_pipeline_manager.h"
 #include "vk_render_target_manager.h"
 #include "vk_command_buffer_builder.h"
 #include "vk_execution_manager.h"
+#include "vk_compressed_upload.h"
+#include "vk_command_pool_manager.h"
+#include "vk_parallel_recorder.h"
+#include "vk_command_graph.h"
+#include "vk_persistent_kernel.h"
+#include "vk_job_scheduler.h"
+#include "vk_frame_manager.h"
 
 using namespace vkw;
 
+#ifdef VK_KHR_timeline_semaphore
+// VK_KHR_timeline_semaphore needs VK_KHR_get_physical_device_properties2 on a 1.0 instance
+bool has_properties2_instance_extension()
+{
+    auto extension_count = 0u;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, nullptr);
+    
+    std::vector<VkExtensionProperties> extensions(extension_count);
+    vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, extensions.data());
+    
+    return std::any_of(extensions.cbegin(), extensions.cend(),
+                       [](VkExtensionProperties const& extension)
+                       {
+                           return std::string(extension.extensionName) ==
+                                  VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+                       });
+}
+#endif
+
 VkScopedObject<VkInstance> create_instance()
 {
     // Initialize usual Vulkan crap
@@ -40,6 +72,16 @@ VkScopedObject<VkInstance> create_instance()
     instance_info.enabledLayerCount = 0;
     instance_info.ppEnabledLayerNames = NULL;
     
+#ifdef VK_KHR_timeline_semaphore
+    const char* properties2_extension_name = VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+    
+    if (has_properties2_instance_extension())
+    {
+        instance_info.enabledExtensionCount = 1;
+        instance_info.ppEnabledExtensionNames = &properties2_extension_name;
+    }
+#endif
+    
     VkInstance instance = nullptr;
     VkResult res = vkCreateInstance(&instance_info, nullptr, &instance);
     if (res == VK_ERROR_INCOMPATIBLE_DRIVER)
@@ -60,7 +102,8 @@ VkScopedObject<VkInstance> create_instance()
 
 VkScopedObject<VkDevice> create_device(VkInstance instance,
                                        std::uint32_t& queue_family_index,
-                                       VkPhysicalDevice* opt_physical_device = nullptr)
+                                       VkPhysicalDevice* opt_physical_device = nullptr,
+                                       DeviceQueues* opt_device_queues = nullptr)
 {
     // Enumerate devices
     auto gpu_count = 0u;
@@ -74,49 +117,138 @@ VkScopedObject<VkDevice> create_device(VkInstance instance,
     std::vector<VkPhysicalDevice> gpus(gpu_count);
     res = vkEnumeratePhysicalDevices(instance, &gpu_count, gpus.data());
     
-    float queue_priority = 0.f;
-    VkDeviceQueueCreateInfo queue_create_info;
-    queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queue_create_info.pNext = nullptr;
-    queue_create_info.flags = 0;
-    queue_create_info.queueCount = 1u;
-    queue_create_info.pQueuePriorities = &queue_priority;
-    
     auto queue_family_count = 0u;
     vkGetPhysicalDeviceQueueFamilyProperties(gpus[0], &queue_family_count, nullptr);
     
     std::vector<VkQueueFamilyProperties> queue_props(queue_family_count);
     vkGetPhysicalDeviceQueueFamilyProperties(gpus[0], &queue_family_count, queue_props.data());
     
-    // Look for a queue supporing both compute and transfer
-    bool found = false;
+    // Graphics family can do everything, look for dedicated async compute
+    // (compute without graphics) and DMA (transfer only) families as well
+    const std::uint32_t kNotFound = ~0u;
+    std::uint32_t graphics_family = kNotFound;
+    std::uint32_t compute_family = kNotFound;
+    std::uint32_t transfer_family = kNotFound;
+    
     for (unsigned int i = 0; i < queue_family_count; i++)
     {
-        if (queue_props[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT))
+        auto flags = queue_props[i].queueFlags;
+        
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) && graphics_family == kNotFound)
         {
-            queue_create_info.queueFamilyIndex = i;
-            found = true;
-            break;
+            graphics_family = i;
+        }
+        else if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && compute_family == kNotFound)
+        {
+            compute_family = i;
+        }
+        else if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+                 transfer_family == kNotFound)
+        {
+            transfer_family = i;
         }
     }
     
-    if (!found)
+    if (graphics_family == kNotFound)
     {
         throw std::runtime_error("No compute/transfer queues found\n");
     }
     
+    compute_family = compute_family == kNotFound ? graphics_family : compute_family;
+    transfer_family = transfer_family == kNotFound ? compute_family : transfer_family;
+    
+    DeviceQueues device_queues;
+    device_queues.family_index[(std::uint32_t)QueueType::kGraphics] = graphics_family;
+    device_queues.family_index[(std::uint32_t)QueueType::kCompute] = compute_family;
+    device_queues.family_index[(std::uint32_t)QueueType::kTransfer] = transfer_family;
+    
+    // Several queues per family let independent producers submit side by side,
+    // families with a queue to spare get one more at a higher priority for
+    // latency sensitive work
+    const std::uint32_t max_queues_per_family = 2u;
+    std::vector<float> queue_priorities(max_queues_per_family, 0.5f);
+    queue_priorities.push_back(1.f);
+    std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
+    
+    for (auto type = 0u; type < kNumQueueTypes; ++type)
+    {
+        auto family_index = device_queues.family_index[type];
+        auto queue_count = std::min(queue_props[family_index].queueCount, max_queues_per_family);
+        device_queues.high_priority_queue[type] = kNoQueue;
+        
+        if (queue_props[family_index].queueCount > max_queues_per_family)
+        {
+            device_queues.high_priority_queue[type] = queue_count++;
+        }
+        
+        device_queues.queue_count[type] = queue_count;
+        
+        auto iter = std::find_if(queue_create_infos.cbegin(),
+                                 queue_create_infos.cend(),
+                                 [family_index](VkDeviceQueueCreateInfo const& info)
+                                 {
+                                     return info.queueFamilyIndex == family_index;
+                                 });
+        
+        if (iter != queue_create_infos.cend())
+        {
+            continue;
+        }
+        
+        VkDeviceQueueCreateInfo queue_create_info;
+        queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queue_create_info.pNext = nullptr;
+        queue_create_info.flags = 0;
+        queue_create_info.queueFamilyIndex = family_index;
+        queue_create_info.queueCount = queue_count;
+        queue_create_info.pQueuePriorities = queue_priorities.data();
+        
+        queue_create_infos.push_back(queue_create_info);
+    }
+    
+    queue_family_index = graphics_family;
+    
     VkDeviceCreateInfo device_create_info;
     device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     device_create_info.pNext = nullptr;
     device_create_info.flags = 0;
-    device_create_info.queueCreateInfoCount = 1u;
-    device_create_info.pQueueCreateInfos = &queue_create_info;
+    device_create_info.queueCreateInfoCount = (std::uint32_t)queue_create_infos.size();
+    device_create_info.pQueueCreateInfos = queue_create_infos.data();
     device_create_info.enabledLayerCount = 0u;
     device_create_info.ppEnabledLayerNames = nullptr;
     device_create_info.enabledExtensionCount = 0u;
     device_create_info.ppEnabledExtensionNames = nullptr;
     device_create_info.pEnabledFeatures = nullptr;
     
+#ifdef VK_KHR_timeline_semaphore
+    // Timeline semaphores back ExecutionManager tickets when available, and
+    // when create_instance could enable the extension they depend on
+    auto extension_count = 0u;
+    vkEnumerateDeviceExtensionProperties(gpus[0], nullptr, &extension_count, nullptr);
+    
+    std::vector<VkExtensionProperties> extensions(extension_count);
+    vkEnumerateDeviceExtensionProperties(gpus[0], nullptr, &extension_count, extensions.data());
+    
+    const char* timeline_extension_name = VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME;
+    
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features;
+    timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timeline_features.pNext = nullptr;
+    timeline_features.timelineSemaphore = VK_TRUE;
+    
+    for (auto& extension : extensions)
+    {
+        if (std::string(extension.extensionName) == timeline_extension_name &&
+            has_properties2_instance_extension())
+        {
+            device_create_info.pNext = &timeline_features;
+            device_create_info.enabledExtensionCount = 1u;
+            device_create_info.ppEnabledExtensionNames = &timeline_extension_name;
+            break;
+        }
+    }
+#endif
+    
     VkDevice device = nullptr;
     res = vkCreateDevice(gpus[0], &device_create_info, nullptr, &device);
     
@@ -130,6 +262,11 @@ VkScopedObject<VkDevice> create_device(VkInstance instance,
         *opt_physical_device = gpus[0];
     }
     
+    if (opt_device_queues)
+    {
+        *opt_device_queues = device_queues;
+    }
+    
     return VkScopedObject<VkDevice>(device,
                                     [](VkDevice device)
                                     {
@@ -137,6 +274,684 @@ VkScopedObject<VkDevice> create_device(VkInstance instance,
                                     });
 }
 
+void bench_parallel_copy(MemoryManager& memory_manager)
+{
+    const std::size_t size = 128u * 1024u * 1024u;
+    const int num_iterations = 10;
+    
+    std::vector<char> data(size, 1);
+    auto buffer = memory_manager.CreateBuffer(size,
+                                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                              VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    
+    auto max_threads = std::max(1u, std::thread::hardware_concurrency());
+    
+    std::cout << "Host to mapped copy, " << (size >> 20) << "MB\n";
+    
+    // Streaming stores alone, the parallel rows split the copy into these
+    {
+        auto mapped = memory_manager.MapBuffer(buffer);
+        StreamingCopy(mapped, data.data(), size);
+        
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        for (auto i = 0; i < num_iterations; ++i)
+        {
+            StreamingCopy(mapped, data.data(), size);
+        }
+        
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        std::cout << "Streaming, 1 thread: " << (double)size * num_iterations / elapsed.count() / 1e9 << " GB/s\n";
+    }
+    
+    for (auto num_threads = 1u; num_threads <= max_threads; num_threads *= 2)
+    {
+        memory_manager.SetCopyThreadCount(num_threads);
+        // Warm up: page in the mapping
+        memory_manager.WriteBuffer(buffer, 0u, size, data.data());
+        
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        for (auto i = 0; i < num_iterations; ++i)
+        {
+            memory_manager.WriteBuffer(buffer, 0u, size, data.data());
+        }
+        
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        auto gbps = (double)size * num_iterations / elapsed.count() / 1e9;
+        
+        // A single copy thread means plain memcpy
+        if (num_threads == 1u)
+        {
+            std::cout << "memcpy baseline, 1 thread: " << gbps << " GB/s\n";
+        }
+        else
+        {
+            std::cout << "Streaming, " << num_threads << " threads: " << gbps << " GB/s\n";
+        }
+    }
+    
+    memory_manager.SetCopyThreadCount(0u);
+}
+
+void bench_compressed_upload(VkDevice device,
+                             ExecutionManager& exec_manager,
+                             MemoryManager& memory_manager,
+                             ShaderManager& shader_manager,
+                             PipelineManager& pipeline_manager)
+{
+    const std::size_t count = 32u * 1024u * 1024u;
+    const VkDeviceSize size = count * sizeof(std::uint32_t);
+    const int num_iterations = 10;
+    
+    // Slowly varying data, the case delta coding is meant for
+    std::vector<std::uint32_t> data(count);
+    std::uint32_t value = 0u;
+    for (auto i = 0u; i < count; ++i)
+    {
+        value += (i * 2654435761u) >> 29;
+        data[i] = value;
+    }
+    
+    auto stream = CompressDeltaBitpack(data.data(), count);
+    auto stream_size = stream.size() * sizeof(std::uint32_t);
+    
+    auto buffer = memory_manager.CreateBuffer(size,
+                                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                              VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                              VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    
+    Decompressor decompressor(device, exec_manager, memory_manager, shader_manager, pipeline_manager);
+    
+    std::cout << "Upload " << (size >> 20) << "MB, compressed " << (stream_size >> 20) << "MB\n";
+    
+    // Warm up both paths and check the result once
+    memory_manager.WriteBuffer(buffer, 0u, size, data.data());
+    decompressor.WriteBufferCompressed(buffer, size, 0u, stream);
+    
+    std::vector<std::uint32_t> result(count);
+    memory_manager.ReadBuffer(buffer, 0u, size, result.data());
+    
+    if (result != data)
+    {
+        throw std::runtime_error("bench_compressed_upload: Decompressed data mismatch");
+    }
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    for (auto i = 0; i < num_iterations; ++i)
+    {
+        memory_manager.WriteBuffer(buffer, 0u, size, data.data());
+    }
+    
+    std::chrono::duration<double> raw = std::chrono::high_resolution_clock::now() - start;
+    
+    start = std::chrono::high_resolution_clock::now();
+    
+    for (auto i = 0; i < num_iterations; ++i)
+    {
+        decompressor.WriteBufferCompressed(buffer, size, 0u, stream);
+    }
+    
+    std::chrono::duration<double> compressed = std::chrono::high_resolution_clock::now() - start;
+    
+    std::cout << "Raw: " << (double)size * num_iterations / raw.count() / 1e9 << " GB/s\n";
+    std::cout << "Compressed: " << (double)size * num_iterations / compressed.count() / 1e9 << " GB/s effective\n";
+}
+
+void bench_submit_batching(VkDevice device,
+                           ExecutionManager& exec_manager,
+                           MemoryManager& memory_manager)
+{
+    const int num_command_buffers = 40;
+    const int num_frames = 100;
+    
+    auto graphics_family = exec_manager.GetQueueFamilyIndex(QueueType::kGraphics);
+    
+    CommandBufferBuilder command_buffer_builder(device, graphics_family, &exec_manager);
+    
+    auto buffer = memory_manager.CreateBuffer(num_command_buffers * 256u,
+                                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                              VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    
+    // A frame worth of small command buffers
+    std::vector<CommandBuffer> command_buffers;
+    for (auto i = 0; i < num_command_buffers; ++i)
+    {
+        command_buffer_builder.BeginCommandBuffer();
+        command_buffer_builder.FillBuffer(buffer, i * 256u, 256u, i);
+        command_buffers.push_back(command_buffer_builder.EndCommandBuffer());
+    }
+    
+    std::cout << num_frames << " frames, " << num_command_buffers << " command buffers each\n";
+    
+    double queue_submit_time[2] = { 0.0, 0.0 };
+    
+    for (auto batching = 0; batching < 2; ++batching)
+    {
+        exec_manager.SetBatching(batching != 0);
+        exec_manager.ResetStats();
+        
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        for (auto frame = 0; frame < num_frames; ++frame)
+        {
+            Ticket ticket = 0u;
+            
+            for (auto& command_buffer : command_buffers)
+            {
+                ticket = exec_manager.Submit(command_buffer);
+            }
+            
+            exec_manager.Wait(ticket);
+        }
+        
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        auto stats = exec_manager.GetStats();
+        queue_submit_time[batching] = stats.queue_submit_time;
+        
+        std::cout << (batching ? "Batched: " : "Unbatched: ")
+                  << stats.num_submits << " submits, "
+                  << stats.num_queue_submits << " vkQueueSubmit calls, "
+                  << stats.queue_submit_time * 1e3 << " ms in vkQueueSubmit, "
+                  << elapsed.count() * 1e3 / num_frames << " ms per frame\n";
+    }
+    
+    std::cout << "CPU time saved: " << (queue_submit_time[0] - queue_submit_time[1]) * 1e3 << " ms\n";
+    
+    exec_manager.SetBatching(false);
+}
+
+void bench_parallel_recording(VkDevice device,
+                              ExecutionManager& exec_manager,
+                              MemoryManager& memory_manager,
+                              ShaderManager& shader_manager,
+                              PipelineManager& pipeline_manager)
+{
+    const std::size_t num_dispatches = 20000u;
+    const int num_iterations = 10;
+    const std::uint32_t group_size = 64u;
+    
+    auto graphics_family = exec_manager.GetQueueFamilyIndex(QueueType::kGraphics);
+    
+    auto shader = shader_manager.CreateShader(VK_SHADER_STAGE_COMPUTE_BIT, "add.comp.spv");
+    auto pipeline = pipeline_manager.CreateComputePipeline(shader, group_size, 1u, 1u);
+    
+    std::vector<int> data(group_size, 1);
+    std::vector<VkScopedObject<VkBuffer>> buffers;
+    for (auto i = 0u; i < 3u; ++i)
+    {
+        buffers.push_back(memory_manager.CreateBuffer(data.size() * sizeof(int),
+                                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                      data.data()));
+        shader.SetArg(i, buffers.back());
+    }
+    
+    // Descriptor set updates are not thread safe, commit before recording in parallel
+    shader.CommitArgs();
+    
+    auto record = [&](CommandBufferBuilder& builder, std::size_t)
+    {
+        builder.Dispatch(pipeline, shader, 1u, 1u, 1u);
+    };
+    
+    std::cout << num_dispatches << " dispatches per command buffer\n";
+    
+    double single_thread_time = 0.0;
+    auto max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    
+    for (auto num_threads = 1u; num_threads <= max_threads; num_threads *= 2u)
+    {
+        // Per row, so the per-thread command pools of the previous row's
+        // workers are released along with them
+        CommandPoolManager command_pool_manager(device, graphics_family, exec_manager);
+        
+        // Calling thread records too. ThreadPool(0) would mean a thread per
+        // core, with one thread the caller records on its own instead.
+        std::unique_ptr<ThreadPool> thread_pool;
+        std::unique_ptr<ParallelRecorder> recorder;
+        
+        if (num_threads > 1u)
+        {
+            thread_pool.reset(new ThreadPool(num_threads - 1u));
+            recorder.reset(new ParallelRecorder(command_pool_manager, *thread_pool));
+        }
+        
+        double record_time = 0.0;
+        
+        for (auto iteration = 0; iteration < num_iterations; ++iteration)
+        {
+            CommandBufferBuilder command_buffer_builder(command_pool_manager);
+            
+            auto start = std::chrono::high_resolution_clock::now();
+            
+            command_buffer_builder.BeginCommandBuffer();
+            
+            if (recorder)
+            {
+                recorder->Record(command_buffer_builder, num_dispatches, record);
+            }
+            else
+            {
+                for (auto i = 0u; i < num_dispatches; ++i)
+                {
+                    record(command_buffer_builder, i);
+                }
+            }
+            
+            auto command_buffer = command_buffer_builder.EndCommandBuffer();
+            
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            record_time += elapsed.count();
+            
+            auto ticket = exec_manager.Submit(command_buffer);
+            command_pool_manager.EndFrame(ticket);
+        }
+        
+        record_time /= num_iterations;
+        
+        if (num_threads == 1u)
+        {
+            single_thread_time = record_time;
+        }
+        
+        std::cout << num_threads << " threads: " << record_time * 1e3 << " ms, "
+                  << num_dispatches / record_time * 1e-6 << " M dispatches/s, "
+                  << single_thread_time / record_time << "x\n";
+        
+        exec_manager.WaitIdle();
+    }
+    
+    exec_manager.WaitIdle();
+}
+
+void bench_command_graph(VkDevice device,
+                         ExecutionManager& exec_manager,
+                         MemoryManager& memory_manager,
+                         ShaderManager& shader_manager,
+                         PipelineManager& pipeline_manager)
+{
+    const int num_dispatches = 200;
+    const int num_iterations = 100;
+    const std::uint32_t group_size = 64u;
+    
+    auto graphics_family = exec_manager.GetQueueFamilyIndex(QueueType::kGraphics);
+    
+    CommandBufferBuilder command_buffer_builder(device, graphics_family, &exec_manager);
+    
+    auto shader = shader_manager.CreateShader(VK_SHADER_STAGE_COMPUTE_BIT, "add.comp.spv");
+    auto pipeline = pipeline_manager.CreateComputePipeline(shader, group_size, 1u, 1u);
+    
+    std::vector<int> data(group_size, 1);
+    std::vector<VkScopedObject<VkBuffer>> buffers;
+    for (auto i = 0u; i < 3u; ++i)
+    {
+        buffers.push_back(memory_manager.CreateBuffer(data.size() * sizeof(int),
+                                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                      data.data()));
+        shader.SetArg(i, buffers.back());
+    }
+    
+    auto record = [&](CommandBufferBuilder& builder)
+    {
+        for (auto i = 0; i < num_dispatches; ++i)
+        {
+            builder.Dispatch(pipeline, shader, 1u, 1u, 1u);
+            builder.Barrier(buffers[2],
+                            VK_ACCESS_SHADER_WRITE_BIT,
+                            VK_ACCESS_SHADER_WRITE_BIT,
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        }
+    };
+    
+    std::cout << num_iterations << " iterations of " << num_dispatches << " dispatches\n";
+    
+    // Record every iteration
+    {
+        double cpu_time = 0.0;
+        
+        for (auto iteration = 0; iteration < num_iterations; ++iteration)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            
+            command_buffer_builder.BeginCommandBuffer();
+            record(command_buffer_builder);
+            auto command_buffer = command_buffer_builder.EndCommandBuffer();
+            auto ticket = exec_manager.Submit(command_buffer);
+            
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            cpu_time += elapsed.count();
+            
+            exec_manager.Wait(ticket);
+        }
+        
+        std::cout << "Re-recorded: " << cpu_time * 1e6 / num_iterations << " us CPU per iteration\n";
+    }
+    
+    // Capture once, patch a parameter and replay
+    {
+        CommandGraph graph(device, memory_manager, exec_manager, sizeof(std::uint32_t));
+        graph.Capture(record);
+        
+        double cpu_time = 0.0;
+        
+        for (auto iteration = 0; iteration < num_iterations; ++iteration)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            
+            graph.SetParameter(0u, (std::uint32_t)iteration);
+            auto ticket = graph.Replay();
+            
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            cpu_time += elapsed.count();
+            
+            exec_manager.Wait(ticket);
+        }
+        
+        std::cout << "Replayed: " << cpu_time * 1e6 / num_iterations << " us CPU per iteration\n";
+    }
+}
+
+void print_latency(char const* name, std::vector<double>& latencies)
+{
+    std::sort(latencies.begin(), latencies.end());
+    
+    double total = 0.0;
+    for (auto latency : latencies)
+    {
+        total += latency;
+    }
+    
+    std::cout << name << ": mean " << total / latencies.size() * 1e6 << " us, "
+              << "p50 " << latencies[latencies.size() / 2] * 1e6 << " us, "
+              << "p99 " << latencies[latencies.size() * 99 / 100] * 1e6 << " us\n";
+}
+
+void bench_persistent_kernel(VkDevice device,
+                             ExecutionManager& exec_manager,
+                             MemoryManager& memory_manager,
+                             ShaderManager& shader_manager,
+                             PipelineManager& pipeline_manager)
+{
+    const int num_jobs = 1000;
+    const std::uint32_t count = 64u;
+    
+    auto queue_family_index = exec_manager.GetQueueFamilyIndex(QueueType::kGraphics);
+    CommandBufferBuilder command_buffer_builder(device, queue_family_index, &exec_manager);
+    
+    // a, b and c back to back, host visible so results can be read right away
+    std::vector<int> data(3u * count, 1);
+    auto data_buffer = memory_manager.CreateBuffer(data.size() * sizeof(int),
+                                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                   data.data());
+    
+    std::cout << num_jobs << " jobs adding " << count << " ints\n";
+    
+    // Record, submit and wait for every job
+    {
+        std::vector<VkScopedObject<VkBuffer>> buffers;
+        auto shader = shader_manager.CreateShader(VK_SHADER_STAGE_COMPUTE_BIT, "add.comp.spv");
+        auto pipeline = pipeline_manager.CreateComputePipeline(shader, count, 1u, 1u);
+        
+        for (auto i = 0u; i < 3u; ++i)
+        {
+            buffers.push_back(memory_manager.CreateBuffer(count * sizeof(int),
+                                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                          data.data()));
+            shader.SetArg(i, buffers.back());
+        }
+        
+        std::vector<double> latencies;
+        
+        for (auto job = 0; job < num_jobs; ++job)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            
+            command_buffer_builder.BeginCommandBuffer();
+            command_buffer_builder.Dispatch(pipeline, shader, 1u, 1u, 1u);
+            auto command_buffer = command_buffer_builder.EndCommandBuffer();
+            exec_manager.Wait(exec_manager.Submit(command_buffer));
+            
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            latencies.push_back(elapsed.count());
+        }
+        
+        print_latency("Submit", latencies);
+    }
+    
+    // Enqueue into the running kernel and poll
+    {
+        PersistentKernel kernel(device,
+                                memory_manager,
+                                shader_manager,
+                                pipeline_manager,
+                                exec_manager,
+                                data_buffer);
+        
+        // Warm up, the first job launches the kernel
+        kernel.Wait(kernel.Enqueue({ 0u, count, 2u * count, count }));
+        
+        std::vector<double> latencies;
+        
+        for (auto job = 0; job < num_jobs; ++job)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            
+            kernel.Wait(kernel.Enqueue({ 0u, count, 2u * count, count }));
+            
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            latencies.push_back(elapsed.count());
+        }
+        
+        print_latency("Persistent", latencies);
+        
+        auto result = static_cast<int const*>(memory_manager.MapBuffer(data_buffer));
+        
+        if (result[2u * count] != 2)
+        {
+            throw std::runtime_error("bench_persistent_kernel: Result mismatch");
+        }
+    }
+}
+
+void print_delay_histogram(std::string const& name, TenantStats const& stats)
+{
+    std::cout << name << ": " << stats.num_jobs << " jobs, mean delay "
+              << (stats.num_jobs ? stats.total_delay / stats.num_jobs * 1e6 : 0.0) << " us, max "
+              << stats.max_delay * 1e6 << " us\n";
+    
+    for (auto bucket = 0u; bucket < kNumDelayBuckets; ++bucket)
+    {
+        if (stats.delay_histogram[bucket] != 0u)
+        {
+            std::cout << "  < " << (1ull << bucket) << " us: " << stats.delay_histogram[bucket] << "\n";
+        }
+    }
+}
+
+void bench_job_scheduler(VkDevice device,
+                         ExecutionManager& exec_manager,
+                         MemoryManager& memory_manager)
+{
+    const int num_batch_jobs = 200;
+    const int num_interactive_jobs = 50;
+    const VkDeviceSize batch_size = 64u * 1024u * 1024u;
+    
+    auto compute_family = exec_manager.GetQueueFamilyIndex(QueueType::kCompute);
+    
+    CommandBufferBuilder command_buffer_builder(device, compute_family, &exec_manager);
+    
+    auto batch_buffer = memory_manager.CreateBuffer(batch_size,
+                                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                    VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    auto interactive_buffer = memory_manager.CreateBuffer(256u,
+                                                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                          VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    
+    // Heavy and tiny command buffers, submitted many times over
+    command_buffer_builder.BeginCommandBuffer();
+    command_buffer_builder.FillBuffer(batch_buffer, 0u, VK_WHOLE_SIZE, 0u);
+    auto batch_command_buffer = command_buffer_builder.EndCommandBuffer();
+    
+    command_buffer_builder.BeginCommandBuffer();
+    command_buffer_builder.FillBuffer(interactive_buffer, 0u, VK_WHOLE_SIZE, 1u);
+    auto interactive_command_buffer = command_buffer_builder.EndCommandBuffer();
+    
+    std::cout << "High priority queue: "
+              << (exec_manager.GetHighPriorityQueue(QueueType::kCompute) != kNoQueue ? "yes" : "no") << "\n";
+    
+    JobScheduler scheduler(exec_manager, QueueType::kCompute);
+    
+    // Batch tenants share 3:1, the interactive one cuts in front of both
+    auto batch_a = scheduler.AddTenant("batch-a", 3u);
+    auto batch_b = scheduler.AddTenant("batch-b", 1u);
+    auto interactive = scheduler.AddTenant("interactive", 1u, JobPriority::kHigh);
+    
+    for (auto i = 0; i < num_batch_jobs; ++i)
+    {
+        scheduler.Submit(batch_a, batch_command_buffer, batch_size);
+        scheduler.Submit(batch_b, batch_command_buffer, batch_size);
+    }
+    
+    std::vector<double> latencies;
+    
+    for (auto i = 0; i < num_interactive_jobs; ++i)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        scheduler.Wait(scheduler.Submit(interactive, interactive_command_buffer, 256u));
+        
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        latencies.push_back(elapsed.count());
+        
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    
+    // Shares while both batch tenants were backlogged
+    auto stats_a = scheduler.GetTenantStats(batch_a);
+    auto stats_b = scheduler.GetTenantStats(batch_b);
+    std::cout << "Batch jobs sent during interactive run: "
+              << stats_a.num_jobs << " (weight 3) vs " << stats_b.num_jobs << " (weight 1)\n";
+    
+    scheduler.WaitIdle();
+    
+    print_latency("Interactive round trip", latencies);
+    
+    for (auto tenant : { batch_a, batch_b, interactive })
+    {
+        print_delay_histogram(scheduler.GetTenantName(tenant), scheduler.GetTenantStats(tenant));
+    }
+}
+
+void bench_frames_in_flight(VkDevice device,
+                            ExecutionManager& exec_manager,
+                            MemoryManager& memory_manager,
+                            ShaderManager& shader_manager,
+                            PipelineManager& pipeline_manager)
+{
+    const int num_frames = 100;
+    const std::uint32_t count = 1u << 20;
+    const std::uint32_t group_size = 64u;
+    const VkDeviceSize size = count * sizeof(int);
+    
+    auto shader = shader_manager.CreateShader(VK_SHADER_STAGE_COMPUTE_BIT, "add.comp.spv");
+    auto pipeline = pipeline_manager.CreateComputePipeline(shader, group_size, 1u, 1u);
+    
+    std::cout << num_frames << " frames: upload, add and read back " << count << " ints\n";
+    
+    // One slot is the serialized loop
+    for (auto num_slots : { 1u, 3u })
+    {
+        FrameManager frame_manager(device, memory_manager, exec_manager, QueueType::kGraphics, num_slots, 3u * size);
+        CommandBufferBuilder command_buffer_builder(frame_manager.GetCommandPoolManager());
+        ResourceStateTracker state_tracker;
+        command_buffer_builder.SetStateTracker(&state_tracker);
+        
+        // a, b and c per slot
+        std::vector<VkScopedObject<VkBuffer>> buffers;
+        for (auto i = 0u; i < 3u * num_slots; ++i)
+        {
+            buffers.push_back(memory_manager.CreateBuffer(size,
+                                                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                                          VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+        }
+        
+        std::vector<TransientAllocation> readbacks(num_slots);
+        std::vector<int> slot_frames(num_slots, -1);
+        
+        frame_manager.ResetWaitTime();
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        auto check_result = [&](std::uint32_t slot)
+        {
+            auto result = static_cast<int const*>(readbacks[slot].data);
+            
+            if (slot_frames[slot] >= 0 && result[count - 1u] != slot_frames[slot] + 1)
+            {
+                throw std::runtime_error("bench_frames_in_flight: Result mismatch");
+            }
+        };
+        
+        for (auto frame = 0; frame < num_frames; ++frame)
+        {
+            auto slot = frame_manager.BeginFrame();
+            
+            // Results of the frame the slot ran last time around
+            check_result(slot);
+            
+            // CPU side preparation of the inputs
+            auto upload = frame_manager.AllocateTransient(2u * size);
+            auto inputs = static_cast<int*>(upload.data);
+            std::fill(inputs, inputs + count, frame);
+            std::fill(inputs + count, inputs + 2u * count, 1);
+            
+            readbacks[slot] = frame_manager.AllocateTransient(size);
+            slot_frames[slot] = frame;
+            
+            VkBuffer a = buffers[3u * slot];
+            VkBuffer b = buffers[3u * slot + 1u];
+            VkBuffer c = buffers[3u * slot + 2u];
+            
+            frame_manager.BindShader(shader);
+            shader.SetArg(0u, a);
+            shader.SetArg(1u, b);
+            shader.SetArg(2u, c);
+            
+            command_buffer_builder.BeginCommandBuffer();
+            command_buffer_builder.CopyBuffers({ { upload.buffer, a, upload.offset, 0u, size },
+                                                 { upload.buffer, b, upload.offset + size, 0u, size } });
+            command_buffer_builder.Dispatch(pipeline, shader, count / group_size, 1u, 1u);
+            command_buffer_builder.CopyBuffers({ { c, readbacks[slot].buffer, 0u, readbacks[slot].offset, size } });
+            command_buffer_builder.UseBuffer(readbacks[slot].buffer, VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+            auto command_buffer = command_buffer_builder.EndCommandBuffer();
+            
+            frame_manager.EndFrame(command_buffer);
+        }
+        
+        frame_manager.WaitIdle();
+        
+        for (auto slot = 0u; slot < num_slots; ++slot)
+        {
+            check_result(slot);
+        }
+        
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        
+        std::cout << num_slots << (num_slots == 1u ? " slot: " : " slots: ")
+                  << elapsed.count() * 1e3 / num_frames << " ms per frame, "
+                  << frame_manager.GetWaitTime() * 1e3 / num_frames << " ms blocked\n";
+    }
+}
 
 int main(int argc, const char * argv[])
 {
@@ -144,13 +959,67 @@ int main(int argc, const char * argv[])
     
     VkPhysicalDevice physical_device;
     std::uint32_t queue_family_index = 0u;
-    auto device = create_device(instance, queue_family_index, &physical_device);
+    DeviceQueues device_queues;
+    auto device = create_device(instance, queue_family_index, &physical_device, &device_queues);
     
     MemoryAllocator allocator(device, physical_device);
-    MemoryManager memory_manager(device, queue_family_index, allocator);
+    // Single owner of the queues, everything submits through it
+    ExecutionManager exec_manager(device, device_queues);
+    MemoryManager memory_manager(device, exec_manager, allocator);
+    memory_manager.SetSharedQueueFamilies(std::vector<std::uint32_t>(device_queues.family_index,
+                                                                     device_queues.family_index + kNumQueueTypes));
+    
+    if (argc > 1 && std::string(argv[1]) == "--bench-copy")
+    {
+        bench_parallel_copy(memory_manager);
+        return 0;
+    }
+    
     DescriptorManager descriptor_manager(device);
     ShaderManager shader_manager(device, descriptor_manager);
     PipelineManager pipeline_manager(device);
+    
+    if (argc > 1 && std::string(argv[1]) == "--bench-submit")
+    {
+        bench_submit_batching(device, exec_manager, memory_manager);
+        return 0;
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--bench-record")
+    {
+        bench_parallel_recording(device, exec_manager, memory_manager, shader_manager, pipeline_manager);
+        return 0;
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--bench-graph")
+    {
+        bench_command_graph(device, exec_manager, memory_manager, shader_manager, pipeline_manager);
+        return 0;
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--bench-persistent")
+    {
+        bench_persistent_kernel(device, exec_manager, memory_manager, shader_manager, pipeline_manager);
+        return 0;
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--bench-scheduler")
+    {
+        bench_job_scheduler(device, exec_manager, memory_manager);
+        return 0;
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--bench-frames")
+    {
+        bench_frames_in_flight(device, exec_manager, memory_manager, shader_manager, pipeline_manager);
+        return 0;
+    }
+    
+    if (argc > 1 && std::string(argv[1]) == "--bench-decompress")
+    {
+        bench_compressed_upload(device, exec_manager, memory_manager, shader_manager, pipeline_manager);
+        return 0;
+    }
 
     RenderTargetManager render_target_manager(device, memory_manager);
     
@@ -171,9 +1040,13 @@ int main(int argc, const char * argv[])
     
     std::vector<VkPushConstantRange> push_constant_ranges;
 
-    CommandBufferBuilder command_buffer_builder(device, queue_family_index);
-    ExecutionManager exec_manager(device, queue_family_index);
+    VkPhysicalDeviceProperties device_properties;
+    vkGetPhysicalDeviceProperties(physical_device, &device_properties);
     
+    CommandBufferBuilder command_buffer_builder(device, queue_family_index, &exec_manager);
+    command_buffer_builder.SetMaxGroupCount(device_properties.limits.maxComputeWorkGroupCount[0],
+                                            device_properties.limits.maxComputeWorkGroupCount[1],
+                                            device_properties.limits.maxComputeWorkGroupCount[2]);
     auto shader = shader_manager.CreateShader(VK_SHADER_STAGE_COMPUTE_BIT, "add.comp.spv");
     auto pipeline = pipeline_manager.CreateComputePipeline(shader, 64u, 1u, 1u);
     
@@ -214,18 +1087,18 @@ int main(int argc, const char * argv[])
     memory_manager.ReadBuffer(buffer, 0u, new_data.size() * sizeof(int), data.data());
     
     
+    // Barriers come from the reflected shader accesses
+    ResourceStateTracker state_tracker;
+    command_buffer_builder.SetStateTracker(&state_tracker);
+    
     command_buffer_builder.BeginCommandBuffer();
     command_buffer_builder.Dispatch(pipeline, shader, 1u, 1u, 1u);
-    command_buffer_builder.Barrier(buffer_c,
-                                   VK_ACCESS_SHADER_WRITE_BIT,
-                                   VK_ACCESS_HOST_READ_BIT,
-                                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                                   VK_PIPELINE_STAGE_TRANSFER_BIT);
-
+    // Read back through ReadBuffer's staging copy, not by the host directly
+    command_buffer_builder.UseBuffer(buffer_c, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
     
     auto command_buffer = command_buffer_builder.EndCommandBuffer();
-    exec_manager.Submit(command_buffer);
-    exec_manager.WaitIdle();
+    auto ticket = exec_manager.Submit(command_buffer);
+    exec_manager.Wait(ticket);
     
     std::vector<int> result(5);
     memory_manager.ReadBuffer(buffer_c, 0u, 5 * sizeof(int), result.data());
@@ -0,0 +1,363 @@
+#include "vk_checkpoint.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace vkw
+{
+    namespace
+    {
+        char const kCheckpointMagic[8] = { 'V', 'K', 'W', 'C', 'K', 'P', 'T', '\0' };
+        
+        void WriteAll(int file, void const* data, std::size_t size, off_t offset)
+        {
+            auto ptr = static_cast<char const*>(data);
+            
+            while (size > 0u)
+            {
+                auto written = pwrite(file, ptr, size, offset);
+                
+                if (written <= 0)
+                {
+                    throw std::runtime_error("Checkpointer: Cannot write checkpoint file");
+                }
+                
+                ptr += written;
+                size -= written;
+                offset += written;
+            }
+        }
+        
+        std::string GetTempFileName(std::string const& file_name)
+        {
+            return file_name + ".tmp";
+        }
+        
+        // Makes the rename itself durable
+        void SyncDirectory(std::string const& file_name)
+        {
+            auto slash = file_name.find_last_of('/');
+            auto directory = slash == std::string::npos ? std::string(".") : file_name.substr(0u, slash + 1u);
+            auto file = open(directory.c_str(), O_RDONLY);
+            
+            if (file >= 0)
+            {
+                fsync(file);
+                close(file);
+            }
+        }
+        
+        void ReadAll(int file, void* data, std::size_t size, off_t offset)
+        {
+            auto ptr = static_cast<char*>(data);
+            
+            while (size > 0u)
+            {
+                auto read = pread(file, ptr, size, offset);
+                
+                if (read <= 0)
+                {
+                    throw std::runtime_error("Checkpointer: Checkpoint file is truncated");
+                }
+                
+                ptr += read;
+                size -= read;
+                offset += read;
+            }
+        }
+    }
+    
+    Checkpointer::Checkpointer(VkDevice device,
+                               ExecutionManager& execution_manager,
+                               MemoryManager& memory_manager,
+                               VkDeviceSize chunk_size)
+    : memory_manager_(memory_manager)
+    , chunk_size_(chunk_size)
+    , channel_(device, execution_manager, memory_manager, chunk_size)
+    , io_pool_(1u)
+    , chunks_(kMaxPendingWrites)
+    {
+    }
+    
+    Checkpointer::~Checkpointer()
+    {
+        try
+        {
+            Wait();
+        }
+        catch (...)
+        {
+            Close();
+        }
+    }
+    
+    void Checkpointer::Begin(VkBuffer buffer, VkDeviceSize size, std::string const& file_name)
+    {
+        // Only one checkpoint at a time
+        Wait();
+        
+        file_ = open(GetTempFileName(file_name).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        
+        if (file_ < 0)
+        {
+            throw std::runtime_error("Checkpointer: Cannot open " + file_name);
+        }
+        
+        file_name_ = file_name;
+        
+        CheckpointHeader header;
+        std::memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+        header.version = CheckpointHeader::kVersion;
+        header.header_size = sizeof(CheckpointHeader);
+        header.size = size;
+        header.chunk_size = chunk_size_;
+        
+        WriteAll(file_, &header, sizeof(header), 0);
+        
+        buffer_ = buffer;
+        size_ = size;
+        next_offset_ = 0u;
+        num_chunks_ = 0u;
+        
+        Poll();
+    }
+    
+    bool Checkpointer::Poll()
+    {
+        if (file_ < 0)
+        {
+            return true;
+        }
+        
+        channel_.Poll();
+        
+        // Keep every channel slot busy
+        while (next_offset_ < size_ && num_in_flight_ < ReadbackChannel::kNumSlots)
+        {
+            auto offset = next_offset_;
+            auto size = std::min(chunk_size_, size_ - offset);
+            
+            channel_.Enqueue(buffer_,
+                             offset,
+                             size,
+                             [this, offset](void const* data, VkDeviceSize size)
+                             {
+                                 OnChunk(offset, data, size);
+                             });
+            
+            next_offset_ += size;
+            ++num_in_flight_;
+        }
+        
+        while (!pending_writes_.empty() &&
+               pending_writes_.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            RetireWrite();
+        }
+        
+        if (next_offset_ == size_ && num_in_flight_ == 0u && pending_writes_.empty())
+        {
+            Close(true);
+            return true;
+        }
+        
+        return false;
+    }
+    
+    void Checkpointer::Wait()
+    {
+        while (!Poll())
+        {
+            if (num_in_flight_ > 0u)
+            {
+                channel_.Flush();
+            }
+            else if (!pending_writes_.empty())
+            {
+                RetireWrite();
+            }
+        }
+    }
+    
+    void Checkpointer::OnChunk(VkDeviceSize offset, void const* data, VkDeviceSize size)
+    {
+        --num_in_flight_;
+        
+        // Drained after an error
+        if (file_ < 0)
+        {
+            return;
+        }
+        
+        // Chunk buffers are reused round robin, the write that used this
+        // one last is the oldest pending
+        if (pending_writes_.size() == kMaxPendingWrites)
+        {
+            RetireWrite();
+        }
+        
+        auto& chunk = chunks_[num_chunks_++ % kMaxPendingWrites];
+        chunk.assign((char const*)data, (char const*)data + size);
+        
+        auto file = file_;
+        auto chunk_data = chunk.data();
+        auto file_offset = (off_t)(sizeof(CheckpointHeader) + offset);
+        
+        pending_writes_.push_back(io_pool_.Submit([file, chunk_data, size, file_offset]()
+                                                  {
+                                                      WriteAll(file, chunk_data, size, file_offset);
+                                                  }));
+    }
+    
+    void Checkpointer::RetireWrite()
+    {
+        auto write = std::move(pending_writes_.front());
+        pending_writes_.pop_front();
+        
+        try
+        {
+            write.get();
+        }
+        catch (...)
+        {
+            Close();
+            throw;
+        }
+    }
+    
+    void Checkpointer::Close(bool complete)
+    {
+        for (auto& write : pending_writes_)
+        {
+            write.wait();
+        }
+        
+        pending_writes_.clear();
+        
+        auto failed = false;
+        
+        if (file_ >= 0)
+        {
+            auto temp_file_name = GetTempFileName(file_name_);
+            
+            // Only report the checkpoint on disk once its data is
+            auto synced = complete && fsync(file_) == 0;
+            auto closed = close(file_) == 0;
+            file_ = -1;
+            
+            if (synced && closed && std::rename(temp_file_name.c_str(), file_name_.c_str()) == 0)
+            {
+                SyncDirectory(file_name_);
+            }
+            else
+            {
+                unlink(temp_file_name.c_str());
+                failed = complete;
+            }
+        }
+        
+        // Readbacks still in flight are dropped
+        channel_.Flush();
+        num_in_flight_ = 0u;
+        next_offset_ = size_;
+        
+        if (failed)
+        {
+            throw std::runtime_error("Checkpointer: Cannot sync checkpoint file " + file_name_);
+        }
+    }
+    
+    void Checkpointer::Restore(VkBuffer buffer, VkDeviceSize buffer_size, std::string const& file_name)
+    {
+        auto file = open(file_name.c_str(), O_RDONLY);
+        
+        if (file < 0)
+        {
+            throw std::runtime_error("Checkpointer: Cannot open " + file_name);
+        }
+        
+        // Double buffered: read chunk i + 1 while chunk i is uploaded
+        std::vector<char> chunks[2];
+        std::future<void> read;
+        
+        try
+        {
+            CheckpointHeader header;
+            ReadAll(file, &header, sizeof(header), 0);
+            
+            if (std::memcmp(header.magic, kCheckpointMagic, sizeof(header.magic)) != 0 ||
+                header.version != CheckpointHeader::kVersion)
+            {
+                throw std::runtime_error("Checkpointer: Not a checkpoint file " + file_name);
+            }
+            
+            if (header.header_size < sizeof(CheckpointHeader))
+            {
+                throw std::runtime_error("Checkpointer: Invalid header in " + file_name);
+            }
+            
+            // WriteBuffer does not check the range
+            if (header.size > buffer_size)
+            {
+                throw std::runtime_error("Checkpointer: Checkpoint does not fit in the buffer " + file_name);
+            }
+            
+            struct stat file_stat;
+            
+            if (fstat(file, &file_stat) != 0 ||
+                (std::uint64_t)file_stat.st_size < header.header_size + header.size)
+            {
+                throw std::runtime_error("Checkpointer: Checkpoint file is truncated");
+            }
+            
+            auto read_chunk = [this, file, &header](VkDeviceSize offset, std::vector<char>& chunk)
+            {
+                chunk.resize(std::min(chunk_size_, header.size - offset));
+                auto chunk_data = chunk.data();
+                auto chunk_size = chunk.size();
+                auto file_offset = (off_t)(header.header_size + offset);
+                
+                return io_pool_.Submit([file, chunk_data, chunk_size, file_offset]()
+                                       {
+                                           ReadAll(file, chunk_data, chunk_size, file_offset);
+                                       });
+            };
+            
+            if (header.size > 0u)
+            {
+                read = read_chunk(0u, chunks[0]);
+            }
+            
+            for (VkDeviceSize offset = 0u, i = 0u; offset < header.size; offset += chunk_size_, ++i)
+            {
+                read.get();
+                
+                auto& chunk = chunks[i % 2u];
+                
+                if (offset + chunk_size_ < header.size)
+                {
+                    read = read_chunk(offset + chunk_size_, chunks[(i + 1u) % 2u]);
+                }
+                
+                memory_manager_.WriteBuffer(buffer, offset, chunk.size(), chunk.data());
+            }
+        }
+        catch (...)
+        {
+            // The read in flight still writes into chunks
+            if (read.valid())
+            {
+                read.wait();
+            }
+            
+            close(file);
+            throw;
+        }
+        
+        close(file);
+    }
+}
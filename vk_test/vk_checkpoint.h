@@ -0,0 +1,108 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_memory_manager.h"
+#include "vk_readback_channel.h"
+#include "vk_thread_pool.h"
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vkw
+{
+    // Checkpoint file: CheckpointHeader followed by the buffer contents
+    struct CheckpointHeader
+    {
+        static std::uint32_t constexpr kVersion = 1u;
+        
+        char magic[8];             // "VKWCKPT\0"
+        std::uint32_t version;
+        std::uint32_t header_size; // data starts here
+        std::uint64_t size;        // buffer bytes stored
+        std::uint64_t chunk_size;  // chunk size used for writing
+    };
+    
+    // Streams buffers to disk without stalling the caller: chunks are copied
+    // through a ReadbackChannel and written with pwrite on an I/O thread as
+    // soon as they land. GPU work is issued from the calling thread only,
+    // in Begin, Poll and Wait.
+    class Checkpointer
+    {
+    public:
+        static VkDeviceSize constexpr kDefaultChunkSize = 16u * 1024u * 1024u;
+        
+        Checkpointer(VkDevice device,
+                     ExecutionManager& execution_manager,
+                     MemoryManager& memory_manager,
+                     VkDeviceSize chunk_size = kDefaultChunkSize);
+        
+        ~Checkpointer();
+        
+        // Start writing the first size bytes of the buffer (TRANSFER_SRC usage)
+        // to the file. The buffer should not be modified until the checkpoint is done.
+        // Data goes to file_name.tmp, which is synced and renamed over file_name
+        // once complete, so a crash never leaves a truncated checkpoint behind.
+        void Begin(VkBuffer buffer, VkDeviceSize size, std::string const& file_name);
+        
+        // Advance without blocking, returns true when the checkpoint is on disk.
+        // Rethrows I/O errors.
+        bool Poll();
+        
+        // Block until the checkpoint is on disk
+        void Wait();
+        
+        // Read a checkpoint back into the buffer of buffer_size bytes through the
+        // upload path, reading the next chunk while the current one is uploaded.
+        // Throws if the checkpoint is larger than the buffer.
+        void Restore(VkBuffer buffer, VkDeviceSize buffer_size, std::string const& file_name);
+        
+    private:
+        // Chunks read back but not yet written, bounds host memory use
+        static std::uint32_t constexpr kMaxPendingWrites = 4u;
+        
+        void OnChunk(VkDeviceSize offset, void const* data, VkDeviceSize size);
+        
+        void RetireWrite();
+        
+        // Sync and publish the file when complete, discard it otherwise
+        void Close(bool complete = false);
+        
+        MemoryManager& memory_manager_;
+        VkDeviceSize chunk_size_;
+        ReadbackChannel channel_;
+        ThreadPool io_pool_;
+        
+        VkBuffer buffer_ = VK_NULL_HANDLE;
+        VkDeviceSize size_ = 0u;
+        VkDeviceSize next_offset_ = 0u;
+        std::uint32_t num_in_flight_ = 0u;
+        std::uint32_t num_chunks_ = 0u;
+        int file_ = -1;
+        std::string file_name_;
+        
+        std::vector<std::vector<char>> chunks_;
+        std::deque<std::future<void>> pending_writes_;
+    };
+}
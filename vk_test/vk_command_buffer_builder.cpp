@@ -1,14 +1,26 @@
 #include "vk_command_buffer_builder.h"
+#include <algorithm>
+#include <cstring>
 
 namespace vkw
 {
-    CommandBufferBuilder::CommandBufferBuilder(VkDevice device, std::uint32_t queue_family_index)
+    CommandBufferBuilder::CommandBufferBuilder(VkDevice device,
+                                               std::uint32_t queue_family_index,
+                                               ExecutionManager* execution_manager)
     : device_(device)
+    , queue_family_index_(queue_family_index)
+    , execution_manager_(execution_manager)
     {
+        for (auto& free_command_buffers : free_command_buffers_)
+        {
+            free_command_buffers = std::make_shared<std::vector<ReleasedCommandBuffer>>();
+        }
+        
+        // Recycled command buffers are reset implicitly by vkBeginCommandBuffer
         VkCommandPoolCreateInfo pool_create_info;
         pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         pool_create_info.pNext = nullptr;
-        pool_create_info.flags = 0;
+        pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
         pool_create_info.queueFamilyIndex = queue_family_index;
         
         VkCommandPool command_pool = nullptr;
@@ -26,6 +38,13 @@ namespace vkw
                                              });
     }
     
+    CommandBufferBuilder::CommandBufferBuilder(CommandPoolManager& command_pool_manager)
+    : device_(command_pool_manager.GetDevice())
+    , queue_family_index_(command_pool_manager.GetQueueFamilyIndex())
+    , command_pool_manager_(&command_pool_manager)
+    {
+    }
+    
     void CommandBufferBuilder::BeginCommandBuffer()
     {
         if (current_command_buffer_)
@@ -33,14 +52,7 @@ namespace vkw
             throw std::runtime_error("CommandBufferManager: Begin command buffer has been already called");
         }
         
-        VkCommandBufferAllocateInfo command_buffer_alloc_info;
-        command_buffer_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        command_buffer_alloc_info.pNext = nullptr;
-        command_buffer_alloc_info.commandPool = command_pool_;
-        command_buffer_alloc_info.commandBufferCount = 1u;
-        command_buffer_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        
-        vkAllocateCommandBuffers(device_, &command_buffer_alloc_info, &current_command_buffer_);
+        current_command_buffer_ = AcquireCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
         
         VkCommandBufferBeginInfo begin_info;
         begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -51,6 +63,79 @@ namespace vkw
         vkBeginCommandBuffer(current_command_buffer_, &begin_info);
     }
     
+    void CommandBufferBuilder::BeginSecondaryCommandBuffer()
+    {
+        if (current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Begin command buffer has been already called");
+        }
+        
+        current_command_buffer_ = AcquireCommandBuffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+        
+        // Not inside a render pass, nothing to inherit
+        VkCommandBufferInheritanceInfo inheritance_info;
+        inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritance_info.pNext = nullptr;
+        inheritance_info.renderPass = VK_NULL_HANDLE;
+        inheritance_info.subpass = 0u;
+        inheritance_info.framebuffer = VK_NULL_HANDLE;
+        inheritance_info.occlusionQueryEnable = VK_FALSE;
+        inheritance_info.queryFlags = 0u;
+        inheritance_info.pipelineStatistics = 0u;
+        
+        VkCommandBufferBeginInfo begin_info;
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.pNext = nullptr;
+        begin_info.pInheritanceInfo = &inheritance_info;
+        // Frame pool ones are gone after the frame, the others can be executed over and over
+        begin_info.flags = command_pool_manager_ ?
+                           VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT :
+                           VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        
+        vkBeginCommandBuffer(current_command_buffer_, &begin_info);
+    }
+    
+    VkCommandBuffer CommandBufferBuilder::AcquireCommandBuffer(VkCommandBufferLevel level)
+    {
+        current_level_ = level;
+        
+        if (command_pool_manager_)
+        {
+            return command_pool_manager_->AllocateCommandBuffer(level);
+        }
+        
+        auto& free_command_buffers = *free_command_buffers_[level];
+        
+        // Still pending ones have to wait
+        auto iter = std::find_if(free_command_buffers.begin(), free_command_buffers.end(),
+                                 [this](ReleasedCommandBuffer const& released)
+                                 {
+                                     return std::all_of(released.tickets.cbegin(), released.tickets.cend(),
+                                                        [this](Ticket ticket)
+                                                        {
+                                                            return execution_manager_->IsComplete(ticket);
+                                                        });
+                                 });
+        
+        if (iter != free_command_buffers.end())
+        {
+            auto command_buffer = iter->command_buffer;
+            free_command_buffers.erase(iter);
+            return command_buffer;
+        }
+        
+        VkCommandBufferAllocateInfo command_buffer_alloc_info;
+        command_buffer_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        command_buffer_alloc_info.pNext = nullptr;
+        command_buffer_alloc_info.commandPool = command_pool_;
+        command_buffer_alloc_info.commandBufferCount = 1u;
+        command_buffer_alloc_info.level = level;
+        
+        VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+        vkAllocateCommandBuffers(device_, &command_buffer_alloc_info, &command_buffer);
+        return command_buffer;
+    }
+    
     void CommandBufferBuilder::Dispatch(ComputePipeline& pipeline,
                   Shader& shader,
                   std::uint32_t num_groups_x,
@@ -62,18 +147,7 @@ namespace vkw
             throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
         }
         
-        shader.CommitArgs();
-        
-        vkCmdBindPipeline(current_command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
-        vkCmdBindDescriptorSets(current_command_buffer_,
-                                VK_PIPELINE_BIND_POINT_COMPUTE,
-                                pipeline.layout,
-                                0,
-                                1u,
-                                shader.descriptor_set.GetObjectPtr(), 0u,
-                                nullptr);
-        
-          vkCmdDispatch(current_command_buffer_, num_groups_x, num_groups_y, num_groups_z);
+        DispatchSlices(pipeline, shader, GetDispatchSlices(num_groups_x, num_groups_y, num_groups_z));
         
 //        VkBufferMemoryBarrier barrier;
 //        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
@@ -99,6 +173,262 @@ namespace vkw
         
     }
     
+    void CommandBufferBuilder::Dispatch(ComputePipeline& pipeline,
+                                        Shader& shader,
+                                        DispatchSlice const& slice)
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        DispatchSlices(pipeline, shader, std::vector<DispatchSlice>(1u, slice));
+    }
+    
+    void CommandBufferBuilder::DispatchSlices(ComputePipeline& pipeline,
+                                              Shader& shader,
+                                              std::vector<DispatchSlice> const& slices)
+    {
+        // The shader may be shared by several recording threads, base_group is
+        // patched into a copy of its push constant block, never into the shader
+        auto base_group = std::find_if(shader.push_constants.cbegin(), shader.push_constants.cend(),
+                                       [](Shader::PushConstant const& push_constant)
+                                       {
+                                           return push_constant.name == "base_group";
+                                       });
+        auto has_base_group = base_group != shader.push_constants.cend();
+        
+        for (auto& slice : slices)
+        {
+            if (!has_base_group && (slice.base_group[0] || slice.base_group[1] || slice.base_group[2]))
+            {
+                throw std::runtime_error("CommandBufferManager: Sliced dispatch needs a uvec3 base_group push constant");
+            }
+        }
+        
+        shader.CommitArgs();
+        
+        UseShaderArgs(shader, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        FlushBarriers();
+        
+        vkCmdBindPipeline(current_command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+        vkCmdBindDescriptorSets(current_command_buffer_,
+                                VK_PIPELINE_BIND_POINT_COMPUTE,
+                                pipeline.layout,
+                                0,
+                                1u,
+                                shader.descriptor_set.GetObjectPtr(), 0u,
+                                nullptr);
+        
+        std::vector<std::uint8_t> push_constant_data;
+        
+        if (has_base_group)
+        {
+            push_constant_data = shader.push_constant_data;
+        }
+        else
+        {
+            PushConstants(pipeline, shader);
+        }
+        
+        // Slices cover disjoint groups, no barriers in between
+        for (auto& slice : slices)
+        {
+            if (has_base_group)
+            {
+                std::memcpy(push_constant_data.data() + base_group->offset,
+                            slice.base_group,
+                            std::min<std::size_t>(base_group->size, sizeof(slice.base_group)));
+                PushConstants(pipeline, shader, push_constant_data.data());
+            }
+            
+            vkCmdDispatch(current_command_buffer_, slice.num_groups[0], slice.num_groups[1], slice.num_groups[2]);
+        }
+    }
+    
+    void CommandBufferBuilder::SetMaxGroupCount(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+    {
+        if (x == 0u || y == 0u || z == 0u)
+        {
+            throw std::runtime_error("CommandBufferManager: Max group count can not be zero");
+        }
+        
+        max_group_count_[0] = x;
+        max_group_count_[1] = y;
+        max_group_count_[2] = z;
+    }
+    
+    void CommandBufferBuilder::SetSliceTimeBudget(double seconds, double groups_per_second)
+    {
+        max_groups_per_slice_ = (std::uint64_t)std::max(1.0, seconds * groups_per_second);
+    }
+    
+    std::vector<DispatchSlice> CommandBufferBuilder::GetDispatchSlices(std::uint32_t num_groups_x,
+                                                                       std::uint32_t num_groups_y,
+                                                                       std::uint32_t num_groups_z) const
+    {
+        std::uint32_t num_groups[3] = { num_groups_x, num_groups_y, num_groups_z };
+        std::vector<DispatchSlice> slices;
+        
+        if (!num_groups[0] || !num_groups[1] || !num_groups[2])
+        {
+            return slices;
+        }
+        
+        // Fill x first, then whole rows and layers while the budget lasts
+        std::uint32_t slice_size[3];
+        auto budget = max_groups_per_slice_;
+        
+        for (auto i = 0u; i < 3u; ++i)
+        {
+            slice_size[i] = std::min(num_groups[i], max_group_count_[i]);
+            
+            if (budget != 0u)
+            {
+                slice_size[i] = (std::uint32_t)std::min<std::uint64_t>(slice_size[i], budget);
+                budget = std::max<std::uint64_t>(1u, budget / slice_size[i]);
+            }
+        }
+        
+        // 64 bit so the last step can not wrap around and loop forever
+        for (std::uint64_t z = 0u; z < num_groups[2]; z += slice_size[2])
+        {
+            for (std::uint64_t y = 0u; y < num_groups[1]; y += slice_size[1])
+            {
+                for (std::uint64_t x = 0u; x < num_groups[0]; x += slice_size[0])
+                {
+                    DispatchSlice slice;
+                    slice.base_group[0] = (std::uint32_t)x;
+                    slice.base_group[1] = (std::uint32_t)y;
+                    slice.base_group[2] = (std::uint32_t)z;
+                    slice.num_groups[0] = (std::uint32_t)std::min<std::uint64_t>(slice_size[0], num_groups[0] - x);
+                    slice.num_groups[1] = (std::uint32_t)std::min<std::uint64_t>(slice_size[1], num_groups[1] - y);
+                    slice.num_groups[2] = (std::uint32_t)std::min<std::uint64_t>(slice_size[2], num_groups[2] - z);
+                    slices.push_back(slice);
+                }
+            }
+        }
+        
+        return slices;
+    }
+    
+    void CommandBufferBuilder::PushConstants(ComputePipeline& pipeline, Shader& shader)
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        PushConstants(pipeline, shader, shader.push_constant_data.data());
+    }
+    
+    void CommandBufferBuilder::PushConstants(ComputePipeline& pipeline, Shader const& shader, std::uint8_t const* data)
+    {
+        // Values go straight into the command stream, no memory or descriptor update
+        for (auto& range : shader.push_constant_ranges)
+        {
+            vkCmdPushConstants(current_command_buffer_,
+                               pipeline.layout,
+                               range.stageFlags,
+                               range.offset,
+                               range.size,
+                               data + range.offset);
+        }
+    }
+    
+    void CommandBufferBuilder::DispatchIndirect(ComputePipeline& pipeline,
+                                                Shader& shader,
+                                                VkBuffer buffer,
+                                                VkDeviceSize offset)
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        if ((offset % 4) != 0)
+        {
+            throw std::runtime_error("CommandBufferManager: Indirect offset should be a multiple of 4");
+        }
+        
+        shader.CommitArgs();
+        
+        UseShaderArgs(shader, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        UseBuffer(buffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+        FlushBarriers();
+        
+        vkCmdBindPipeline(current_command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+        vkCmdBindDescriptorSets(current_command_buffer_,
+                                VK_PIPELINE_BIND_POINT_COMPUTE,
+                                pipeline.layout,
+                                0,
+                                1u,
+                                shader.descriptor_set.GetObjectPtr(), 0u,
+                                nullptr);
+        
+        PushConstants(pipeline, shader);
+        
+        vkCmdDispatchIndirect(current_command_buffer_, buffer, offset);
+    }
+    
+    void CommandBufferBuilder::UseShaderArgs(Shader& shader, VkPipelineStageFlags stage)
+    {
+        if (!state_tracker_)
+        {
+            return;
+        }
+        
+        for (auto& binding : shader.bindings)
+        {
+            auto& arg = binding.second;
+            
+            switch (arg.type)
+            {
+                case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+                case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+                    if (arg.buffer)
+                    {
+                        UseBuffer(arg.buffer, stage, arg.access);
+                    }
+                    break;
+                case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+                    if (arg.image)
+                    {
+                        UseImage(arg.image, stage, arg.access, VK_IMAGE_LAYOUT_GENERAL);
+                    }
+                    break;
+                case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+                case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+                    if (arg.image)
+                    {
+                        UseImage(arg.image, stage, arg.access, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    
+    void CommandBufferBuilder::ExecuteCommands(std::vector<VkCommandBuffer> const& command_buffers)
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        if (command_buffers.empty())
+        {
+            return;
+        }
+        
+        FlushBarriers();
+        
+        vkCmdExecuteCommands(current_command_buffer_,
+                             static_cast<std::uint32_t>(command_buffers.size()),
+                             command_buffers.data());
+    }
+    
     CommandBuffer CommandBufferBuilder::EndCommandBuffer()
     {
         if (!current_command_buffer_)
@@ -106,15 +436,29 @@ namespace vkw
             throw std::runtime_error("CommandBufferManager: End called without calling Begin");
         }
         
+        // Trailing barriers still order against whatever comes next in the submission
+        FlushBarriers();
+        
         vkEndCommandBuffer(current_command_buffer_);
         
         auto command_buffer = current_command_buffer_;
         current_command_buffer_ = nullptr;
         
+        // Owned by the frame's pool
+        if (command_pool_manager_)
+        {
+            return CommandBuffer(command_buffer, nullptr);
+        }
+        
         return CommandBuffer(command_buffer,
-                             [device = device_, pool = (VkCommandPool)command_pool_](VkCommandBuffer buffer)
+                             [free_command_buffers = free_command_buffers_[current_level_],
+                              execution_manager = execution_manager_](VkCommandBuffer buffer)
                              {
-                                 vkFreeCommandBuffers(device, pool, 1u, &buffer);
+                                 // Any submission of the buffer was made before its handle went away
+                                 free_command_buffers->push_back({ buffer,
+                                                                   execution_manager ?
+                                                                   execution_manager->GetLastTickets() :
+                                                                   std::vector<Ticket>() });
                              });
     }
     
@@ -123,34 +467,319 @@ namespace vkw
                                        VkAccessFlags src_access,
                                        VkAccessFlags dst_access,
                                        VkPipelineStageFlags src_stage,
-                                       VkPipelineStageFlags dst_stage)
+                                       VkPipelineStageFlags dst_stage,
+                                       VkDeviceSize offset,
+                                       VkDeviceSize size)
     {
         if (!current_command_buffer_)
         {
             throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
         }
         
+        pending_src_stage_ |= src_stage;
+        pending_dst_stage_ |= dst_stage;
+        
+        // Same range queued twice, merge access masks
+        for (auto& barrier : pending_buffer_barriers_)
+        {
+            if (barrier.buffer == buffer && barrier.offset == offset && barrier.size == size)
+            {
+                barrier.srcAccessMask |= src_access;
+                barrier.dstAccessMask |= dst_access;
+                return;
+            }
+        }
+        
         VkBufferMemoryBarrier barrier;
         barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
         barrier.pNext = nullptr;
         barrier.buffer = buffer;
-        barrier.offset = 0u;
-        barrier.size = VK_WHOLE_SIZE;
+        barrier.offset = offset;
+        barrier.size = size;
         barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
         barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
         barrier.srcAccessMask = src_access;
         barrier.dstAccessMask = dst_access;
         
+        pending_buffer_barriers_.push_back(barrier);
+    }
+    
+    void CommandBufferBuilder::GlobalBarrier(VkAccessFlags src_access,
+                                             VkAccessFlags dst_access,
+                                             VkPipelineStageFlags src_stage,
+                                             VkPipelineStageFlags dst_stage)
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        pending_src_stage_ |= src_stage;
+        pending_dst_stage_ |= dst_stage;
+        
+        if (!pending_global_barrier_)
+        {
+            pending_memory_barrier_.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            pending_memory_barrier_.pNext = nullptr;
+            pending_memory_barrier_.srcAccessMask = 0u;
+            pending_memory_barrier_.dstAccessMask = 0u;
+            pending_global_barrier_ = true;
+        }
+        
+        pending_memory_barrier_.srcAccessMask |= src_access;
+        pending_memory_barrier_.dstAccessMask |= dst_access;
+    }
+    
+    void CommandBufferBuilder::ImageBarrier(VkImage image,
+                                            VkImageLayout old_layout,
+                                            VkImageLayout new_layout,
+                                            VkAccessFlags src_access,
+                                            VkAccessFlags dst_access,
+                                            VkPipelineStageFlags src_stage,
+                                            VkPipelineStageFlags dst_stage,
+                                            VkImageSubresourceRange const& range)
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        VkImageMemoryBarrier barrier;
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.pNext = nullptr;
+        barrier.srcAccessMask = src_access;
+        barrier.dstAccessMask = dst_access;
+        barrier.oldLayout = old_layout;
+        barrier.newLayout = new_layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange = range;
+        
+        PipelineBarrier(src_stage, dst_stage, {}, { barrier });
+    }
+    
+    void CommandBufferBuilder::PipelineBarrier(VkPipelineStageFlags src_stage,
+                                               VkPipelineStageFlags dst_stage,
+                                               std::vector<VkBufferMemoryBarrier> const& buffer_barriers,
+                                               std::vector<VkImageMemoryBarrier> const& image_barriers)
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        for (auto& barrier : buffer_barriers)
+        {
+            Barrier(barrier.buffer,
+                    barrier.srcAccessMask,
+                    barrier.dstAccessMask,
+                    src_stage,
+                    dst_stage,
+                    barrier.offset,
+                    barrier.size);
+        }
+        
+        pending_src_stage_ |= src_stage;
+        pending_dst_stage_ |= dst_stage;
+        
+        for (auto& image_barrier : image_barriers)
+        {
+            auto iter = std::find_if(pending_image_barriers_.begin(), pending_image_barriers_.end(),
+                                     [&image_barrier](VkImageMemoryBarrier const& barrier)
+                                     {
+                                         auto& a = barrier.subresourceRange;
+                                         auto& b = image_barrier.subresourceRange;
+                                         return barrier.image == image_barrier.image &&
+                                                barrier.oldLayout == image_barrier.oldLayout &&
+                                                barrier.newLayout == image_barrier.newLayout &&
+                                                a.aspectMask == b.aspectMask &&
+                                                a.baseMipLevel == b.baseMipLevel &&
+                                                a.levelCount == b.levelCount &&
+                                                a.baseArrayLayer == b.baseArrayLayer &&
+                                                a.layerCount == b.layerCount;
+                                     });
+            
+            if (iter != pending_image_barriers_.end())
+            {
+                iter->srcAccessMask |= image_barrier.srcAccessMask;
+                iter->dstAccessMask |= image_barrier.dstAccessMask;
+            }
+            else
+            {
+                pending_image_barriers_.push_back(image_barrier);
+            }
+        }
+    }
+    
+    void CommandBufferBuilder::UseBuffer(VkBuffer buffer, VkPipelineStageFlags stage, VkAccessFlags access)
+    {
+        if (!state_tracker_)
+        {
+            return;
+        }
+        
+        auto barrier = state_tracker_->AccessBuffer(buffer, queue_family_index_, stage, access);
+        
+        if (barrier.src_stage != 0u)
+        {
+            Barrier(buffer, barrier.src_access, barrier.dst_access, barrier.src_stage, barrier.dst_stage);
+        }
+    }
+    
+    void CommandBufferBuilder::UseImage(VkImage image, VkPipelineStageFlags stage, VkAccessFlags access, VkImageLayout layout)
+    {
+        if (!state_tracker_)
+        {
+            return;
+        }
+        
+        auto barrier = state_tracker_->AccessImage(image, queue_family_index_, stage, access, layout);
+        
+        if (barrier.src_stage != 0u)
+        {
+            ImageBarrier(image,
+                         barrier.old_layout,
+                         barrier.new_layout,
+                         barrier.src_access,
+                         barrier.dst_access,
+                         barrier.src_stage,
+                         barrier.dst_stage);
+        }
+    }
+    
+    void CommandBufferBuilder::FlushBarriers()
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        if (pending_src_stage_ == 0u && pending_dst_stage_ == 0u)
+        {
+            return;
+        }
+        
+        // Execution only dependencies still need valid stage masks
+        auto src_stage = pending_src_stage_ ? pending_src_stage_ : (VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        auto dst_stage = pending_dst_stage_ ? pending_dst_stage_ : (VkPipelineStageFlags)VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        
         vkCmdPipelineBarrier(current_command_buffer_,
                              src_stage,
                              dst_stage,
                              0u,
-                             0u,
-                             nullptr,
-                             1u,
-                             &barrier,
-                             0u,
-                             nullptr);
+                             pending_global_barrier_ ? 1u : 0u,
+                             &pending_memory_barrier_,
+                             static_cast<std::uint32_t>(pending_buffer_barriers_.size()),
+                             pending_buffer_barriers_.data(),
+                             static_cast<std::uint32_t>(pending_image_barriers_.size()),
+                             pending_image_barriers_.data());
+        
+        pending_src_stage_ = 0u;
+        pending_dst_stage_ = 0u;
+        pending_global_barrier_ = false;
+        pending_buffer_barriers_.clear();
+        pending_image_barriers_.clear();
+    }
+    
+    void CommandBufferBuilder::FillBuffer(VkBuffer buffer,
+                                          VkDeviceSize offset,
+                                          VkDeviceSize size,
+                                          std::uint32_t value)
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        if ((offset % 4) != 0 || (size != VK_WHOLE_SIZE && (size % 4) != 0))
+        {
+            throw std::runtime_error("CommandBufferManager: Fill offset and size should be multiples of 4");
+        }
+        
+        if (size == 0u)
+        {
+            throw std::runtime_error("CommandBufferManager: Fill size can not be zero");
+        }
+        
+        UseBuffer(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+        FlushBarriers();
+        
+        vkCmdFillBuffer(current_command_buffer_, buffer, offset, size, value);
+    }
+    
+    void CommandBufferBuilder::UpdateBuffer(VkBuffer buffer,
+                                            VkDeviceSize offset,
+                                            VkDeviceSize size,
+                                            void const* data)
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        if ((offset % 4) != 0 || (size % 4) != 0)
+        {
+            throw std::runtime_error("CommandBufferManager: Update offset and size should be multiples of 4");
+        }
+        
+        if (size == 0u)
+        {
+            throw std::runtime_error("CommandBufferManager: Update size can not be zero");
+        }
+        
+        if (size > kMaxUpdateBufferSize)
+        {
+            throw std::runtime_error("CommandBufferManager: Update size exceeds 64KB, use MemoryManager::WriteBuffer instead");
+        }
+        
+        UseBuffer(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+        FlushBarriers();
+        
+        vkCmdUpdateBuffer(current_command_buffer_, buffer, offset, size, data);
+    }
+    
+    void CommandBufferBuilder::CopyBuffers(std::vector<BufferCopyRegion> const& regions)
+    {
+        if (!current_command_buffer_)
+        {
+            throw std::runtime_error("CommandBufferManager: Attempt to record command without calling Begin()");
+        }
+        
+        // One access per buffer, regions of the same copy do not order against each other
+        std::vector<std::pair<VkBuffer, VkAccessFlags>> accesses;
+        
+        auto add_access = [&accesses](VkBuffer buffer, VkAccessFlags access)
+        {
+            auto iter = std::find_if(accesses.begin(), accesses.end(),
+                                     [buffer](std::pair<VkBuffer, VkAccessFlags> const& entry)
+                                     {
+                                         return entry.first == buffer;
+                                     });
+            
+            if (iter == accesses.end())
+            {
+                accesses.emplace_back(buffer, access);
+            }
+            else
+            {
+                iter->second |= access;
+            }
+        };
+        
+        for (auto& region : regions)
+        {
+            add_access(region.src_buffer, VK_ACCESS_TRANSFER_READ_BIT);
+            add_access(region.dst_buffer, VK_ACCESS_TRANSFER_WRITE_BIT);
+        }
+        
+        for (auto& access : accesses)
+        {
+            UseBuffer(access.first, VK_PIPELINE_STAGE_TRANSFER_BIT, access.second);
+        }
+        
+        FlushBarriers();
         
+        RecordBufferCopies(current_command_buffer_, regions);
     }
 }
@@ -23,17 +23,71 @@
 #include <vulkan/vulkan.h>
 #include "vk_scoped_object.h"
 #include "vk_pipeline_manager.h"
+#include "vk_utils.h"
+#include "vk_command_pool_manager.h"
+#include "vk_resource_state_tracker.h"
+#include <memory>
+#include <vector>
 
 namespace vkw
 {
     using CommandBuffer = VkScopedObject<VkCommandBuffer>;
+    
+    // Part of a dispatch grid, in workgroups
+    struct DispatchSlice
+    {
+        std::uint32_t base_group[3];
+        std::uint32_t num_groups[3];
+    };
+    
     class CommandBufferBuilder
     {
     public:
-        CommandBufferBuilder(VkDevice device, std::uint32_t queue_family_index);
+        // vkCmdUpdateBuffer limit on the inline data size
+        static VkDeviceSize constexpr kMaxUpdateBufferSize = 65536u;
+        
+        // Command buffers are recycled once their CommandBuffer handle goes away
+        // and, with an ExecutionManager, the work submitted until then is
+        // complete. Without one the handle must outlive the GPU work using it.
+        CommandBufferBuilder(VkDevice device,
+                             std::uint32_t queue_family_index,
+                             ExecutionManager* execution_manager = nullptr);
+        
+        // Command buffers come from the calling thread's pool for the current
+        // frame, the returned CommandBuffer does not own them
+        explicit CommandBufferBuilder(CommandPoolManager& command_pool_manager);
+        
+        // Spec minimum for maxComputeWorkGroupCount
+        static std::uint32_t constexpr kMinMaxGroupCount = 65535u;
+        
+        // Dispatches larger than the device limit, or than max_groups_per_slice
+        // when not 0, are split into several vkCmdDispatch. Slices after the
+        // first need the kernel to offset gl_WorkGroupID by a uvec3 base_group
+        // push constant. It is set per slice in the command stream, the Shader
+        // itself is left untouched.
+        void SetMaxGroupCount(std::uint32_t x, std::uint32_t y, std::uint32_t z);
+        void SetMaxGroupsPerSlice(std::uint64_t max_groups_per_slice) { max_groups_per_slice_ = max_groups_per_slice; }
+        
+        // Slice size for a time budget given a measured throughput of the kernel
+        void SetSliceTimeBudget(double seconds, double groups_per_second);
+        
+        // Slices Dispatch would record, in order. Recording them one per
+        // command buffer lets a JobScheduler run other work in between.
+        std::vector<DispatchSlice> GetDispatchSlices(std::uint32_t num_groups_x,
+                                                     std::uint32_t num_groups_y,
+                                                     std::uint32_t num_groups_z) const;
+        
+        // Dispatch, fill, update and copy commands queue the barriers their
+        // buffers and images need against the last tracked access
+        void SetStateTracker(ResourceStateTracker* state_tracker) { state_tracker_ = state_tracker; }
+        ResourceStateTracker* GetStateTracker() const { return state_tracker_; }
         
         void BeginCommandBuffer();
         
+        // Secondary command buffer for use with ExecuteCommands, outside of a render
+        // pass. Frame pool ones are one time submit, the others reusable.
+        void BeginSecondaryCommandBuffer();
+        
         void Dispatch(ComputePipeline& pipeline,
                       Shader& shader,
                       std::uint32_t group_size_x,
@@ -43,17 +97,125 @@ namespace vkw
                       //std::uint32_t num_groups_y,
                       //std::uint32_t num_groups_z);
         
+        void Dispatch(ComputePipeline& pipeline,
+                      Shader& shader,
+                      DispatchSlice const& slice);
+        
+        // Record the shader's current push constant values, Dispatch does it implicitly
+        void PushConstants(ComputePipeline& pipeline, Shader& shader);
+        
+        // Group counts are read on the GPU from a VkDispatchIndirectCommand at
+        // offset, buffer needs INDIRECT_BUFFER usage
+        void DispatchIndirect(ComputePipeline& pipeline,
+                              Shader& shader,
+                              VkBuffer buffer,
+                              VkDeviceSize offset);
+        
+        // Barriers are queued and flushed as one vkCmdPipelineBarrier with merged
+        // stage masks right before the next command that needs them
         void Barrier(VkBuffer buffer,
                      VkAccessFlags src_access,
                      VkAccessFlags dst_access,
                      VkPipelineStageFlags src_stage,
-                     VkPipelineStageFlags dst_stage);
+                     VkPipelineStageFlags dst_stage,
+                     VkDeviceSize offset = 0u,
+                     VkDeviceSize size = VK_WHOLE_SIZE);
+        
+        // Memory dependency over all resources
+        void GlobalBarrier(VkAccessFlags src_access,
+                           VkAccessFlags dst_access,
+                           VkPipelineStageFlags src_stage,
+                           VkPipelineStageFlags dst_stage);
+        
+        // Layout transition, whole color image by default
+        void ImageBarrier(VkImage image,
+                          VkImageLayout old_layout,
+                          VkImageLayout new_layout,
+                          VkAccessFlags src_access,
+                          VkAccessFlags dst_access,
+                          VkPipelineStageFlags src_stage,
+                          VkPipelineStageFlags dst_stage,
+                          VkImageSubresourceRange const& range = { VK_IMAGE_ASPECT_COLOR_BIT,
+                                                                   0u, VK_REMAINING_MIP_LEVELS,
+                                                                   0u, VK_REMAINING_ARRAY_LAYERS });
+        
+        // Queue a set of buffer and image barriers
+        void PipelineBarrier(VkPipelineStageFlags src_stage,
+                             VkPipelineStageFlags dst_stage,
+                             std::vector<VkBufferMemoryBarrier> const& buffer_barriers,
+                             std::vector<VkImageMemoryBarrier> const& image_barriers);
+        
+        // Declare accesses the builder does not record itself (host reads,
+        // vertex input, ...) to the state tracker, no-op without one
+        void UseBuffer(VkBuffer buffer, VkPipelineStageFlags stage, VkAccessFlags access);
+        void UseImage(VkImage image, VkPipelineStageFlags stage, VkAccessFlags access, VkImageLayout layout);
+        
+        // Record the queued barriers now, called implicitly by the other commands
+        void FlushBarriers();
+        
+        // Fill buffer range with a repeated 32-bit value (VK_WHOLE_SIZE fills up to the end).
+        // Offset and size non-zero multiples of 4, buffer needs TRANSFER_DST usage.
+        void FillBuffer(VkBuffer buffer,
+                        VkDeviceSize offset,
+                        VkDeviceSize size,
+                        std::uint32_t value);
+        
+        // Write up to kMaxUpdateBufferSize bytes inline into the command stream.
+        // Offset and size should be multiples of 4, size non-zero, buffer needs TRANSFER_DST usage.
+        void UpdateBuffer(VkBuffer buffer,
+                          VkDeviceSize offset,
+                          VkDeviceSize size,
+                          void const* data);
+        
+        // Device to device copies grouped into one vkCmdCopyBuffer per (src, dst) pair
+        void CopyBuffers(std::vector<BufferCopyRegion> const& regions);
+        
+        // Execute secondary command buffers in the given order
+        void ExecuteCommands(std::vector<VkCommandBuffer> const& command_buffers);
         
         CommandBuffer EndCommandBuffer();
         
     private:
+        VkCommandBuffer AcquireCommandBuffer(VkCommandBufferLevel level);
+        
+        // Push the shader's ranges from data laid out like its push constant block
+        void PushConstants(ComputePipeline& pipeline, Shader const& shader, std::uint8_t const* data);
+        
+        void DispatchSlices(ComputePipeline& pipeline,
+                            Shader& shader,
+                            std::vector<DispatchSlice> const& slices);
+        
+        // Queue tracked barriers for the shader's bound arguments
+        void UseShaderArgs(Shader& shader, VkPipelineStageFlags stage);
+        
         VkDevice device_ = VK_NULL_HANDLE;
+        std::uint32_t queue_family_index_ = 0u;
+        ResourceStateTracker* state_tracker_ = nullptr;
         VkCommandBuffer current_command_buffer_ = VK_NULL_HANDLE;
         VkScopedObject<VkCommandPool> command_pool_ = VK_NULL_HANDLE;
+        CommandPoolManager* command_pool_manager_ = nullptr;
+        ExecutionManager* execution_manager_ = nullptr;
+        
+        // Released by a CommandBuffer handle, reusable once the tickets are complete
+        struct ReleasedCommandBuffer
+        {
+            VkCommandBuffer command_buffer;
+            std::vector<Ticket> tickets;
+        };
+        
+        // Reused by BeginCommandBuffer, per level
+        std::shared_ptr<std::vector<ReleasedCommandBuffer>> free_command_buffers_[2];
+        VkCommandBufferLevel current_level_ = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        
+        std::uint32_t max_group_count_[3] = { kMinMaxGroupCount, kMinMaxGroupCount, kMinMaxGroupCount };
+        std::uint64_t max_groups_per_slice_ = 0u;
+        
+        // Queued by the barrier calls until FlushBarriers
+        VkPipelineStageFlags pending_src_stage_ = 0u;
+        VkPipelineStageFlags pending_dst_stage_ = 0u;
+        bool pending_global_barrier_ = false;
+        VkMemoryBarrier pending_memory_barrier_;
+        std::vector<VkBufferMemoryBarrier> pending_buffer_barriers_;
+        std::vector<VkImageMemoryBarrier> pending_image_barriers_;
     };
 }
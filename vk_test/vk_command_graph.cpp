@@ -0,0 +1,113 @@
+#include "vk_command_graph.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace vkw
+{
+    CommandGraph::CommandGraph(VkDevice device,
+                               MemoryManager& memory_manager,
+                               ExecutionManager& execution_manager,
+                               VkDeviceSize parameter_size,
+                               QueueType queue_type,
+                               std::uint32_t max_replays_in_flight)
+    : memory_manager_(memory_manager)
+    , execution_manager_(execution_manager)
+    , queue_type_(queue_type)
+    , command_buffer_builder_(device, execution_manager.GetQueueFamilyIndex(queue_type), &execution_manager)
+    , parameter_size_((parameter_size + 3u) & ~VkDeviceSize(3u))
+    , parameters_(parameter_size_)
+    , slots_(std::max(max_replays_in_flight, 1u))
+    {
+        if (parameter_size_ == 0u)
+        {
+            throw std::runtime_error("CommandGraph: Parameter buffer can not be empty");
+        }
+        
+        parameter_buffer_ = memory_manager_.CreateBuffer(parameter_size_,
+                                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                                                         VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                                         VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        
+        staging_buffer_ = memory_manager_.CreateBuffer(parameter_size_ * slots_.size(),
+                                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                       VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    }
+    
+    void CommandGraph::Capture(RecordFunc const& record)
+    {
+        // Slot command buffers still reference the old graph
+        for (auto& slot : slots_)
+        {
+            execution_manager_.Wait(slot.ticket);
+            slot.command_buffer = nullptr;
+        }
+        
+        command_buffer_builder_.BeginSecondaryCommandBuffer();
+        record(command_buffer_builder_);
+        graph_ = command_buffer_builder_.EndCommandBuffer();
+        
+        std::vector<VkCommandBuffer> graph = { graph_ };
+        
+        // One primary per slot: patch the parameters, then run the graph
+        for (auto i = 0u; i < slots_.size(); ++i)
+        {
+            command_buffer_builder_.BeginCommandBuffer();
+            
+            // The previous replay may still be using the parameters or the graph's resources
+            command_buffer_builder_.GlobalBarrier(VK_ACCESS_MEMORY_WRITE_BIT,
+                                                  VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+                                                  VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                                                  VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+            
+            command_buffer_builder_.CopyBuffers({ { staging_buffer_, parameter_buffer_, i * parameter_size_, 0u, parameter_size_ } });
+            
+            command_buffer_builder_.Barrier(parameter_buffer_,
+                                            VK_ACCESS_TRANSFER_WRITE_BIT,
+                                            VK_ACCESS_SHADER_READ_BIT |
+                                            VK_ACCESS_UNIFORM_READ_BIT |
+                                            VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                                            VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+            
+            command_buffer_builder_.ExecuteCommands(graph);
+            
+            slots_[i].command_buffer = command_buffer_builder_.EndCommandBuffer();
+        }
+        
+        next_slot_ = 0u;
+    }
+    
+    void CommandGraph::SetParameters(VkDeviceSize offset, VkDeviceSize size, void const* data)
+    {
+        if (offset + size > parameter_size_)
+        {
+            throw std::runtime_error("CommandGraph: Parameters out of range");
+        }
+        
+        std::memcpy(parameters_.data() + offset, data, size);
+    }
+    
+    Ticket CommandGraph::Replay(std::vector<Ticket> const& wait_tickets)
+    {
+        if (!graph_)
+        {
+            throw std::runtime_error("CommandGraph: Replay called before Capture");
+        }
+        
+        auto& slot = slots_[next_slot_];
+        
+        // Staging slot is free once its last replay is done
+        execution_manager_.Wait(slot.ticket);
+        
+        memory_manager_.WriteBuffer(staging_buffer_, next_slot_ * parameter_size_, parameter_size_, parameters_.data());
+        
+        slot.ticket = execution_manager_.Submit(slot.command_buffer, queue_type_, wait_tickets);
+        next_slot_ = (next_slot_ + 1u) % slots_.size();
+        
+        return slot.ticket;
+    }
+}
@@ -0,0 +1,90 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_scoped_object.h"
+#include "vk_memory_manager.h"
+#include "vk_execution_manager.h"
+#include "vk_command_buffer_builder.h"
+#include <functional>
+#include <vector>
+
+namespace vkw
+{
+    // Command sequence recorded once into a reusable secondary command buffer
+    // and replayed with a single submit. Everything recorded is fixed after
+    // Capture, push constants and descriptor sets included, values that change
+    // between replays go into the parameter buffer instead. Each replay copies
+    // the current parameters in from a host visible staging slot before
+    // running the graph.
+    class CommandGraph
+    {
+    public:
+        using RecordFunc = std::function<void(CommandBufferBuilder& builder)>;
+        
+        static std::uint32_t constexpr kDefaultMaxReplaysInFlight = 2u;
+        
+        CommandGraph(VkDevice device,
+                     MemoryManager& memory_manager,
+                     ExecutionManager& execution_manager,
+                     VkDeviceSize parameter_size,
+                     QueueType queue_type = QueueType::kGraphics,
+                     std::uint32_t max_replays_in_flight = kDefaultMaxReplaysInFlight);
+        
+        // Device local, readable as a storage or uniform buffer or as indirect arguments
+        VkBuffer GetParameterBuffer() { return parameter_buffer_; }
+        
+        // Record the graph, replaces the previous capture
+        void Capture(RecordFunc const& record);
+        
+        // Picked up by the next Replay
+        void SetParameters(VkDeviceSize offset, VkDeviceSize size, void const* data);
+        
+        template <typename T>
+        void SetParameter(VkDeviceSize offset, T const& value) { SetParameters(offset, sizeof(T), &value); }
+        
+        // Replays are ordered after each other, blocks only when all of the
+        // staging slots are still in flight
+        Ticket Replay(std::vector<Ticket> const& wait_tickets = std::vector<Ticket>());
+        
+    private:
+        struct Slot
+        {
+            CommandBuffer command_buffer;
+            Ticket ticket = 0u;
+        };
+        
+        MemoryManager& memory_manager_;
+        ExecutionManager& execution_manager_;
+        QueueType queue_type_;
+        CommandBufferBuilder command_buffer_builder_;
+        
+        VkDeviceSize parameter_size_;
+        VkScopedObject<VkBuffer> parameter_buffer_;
+        VkScopedObject<VkBuffer> staging_buffer_;
+        std::vector<std::uint8_t> parameters_;
+        
+        CommandBuffer graph_;
+        std::vector<Slot> slots_;
+        std::uint32_t next_slot_ = 0u;
+    };
+}
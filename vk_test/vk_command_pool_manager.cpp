@@ -0,0 +1,125 @@
+#include "vk_command_pool_manager.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace vkw
+{
+    CommandPoolManager::CommandPoolManager(VkDevice device,
+                                           std::uint32_t queue_family_index,
+                                           ExecutionManager& execution_manager,
+                                           std::uint32_t num_frames)
+    : device_(device)
+    , queue_family_index_(queue_family_index)
+    , execution_manager_(execution_manager)
+    , frames_(std::max(1u, num_frames))
+    {
+    }
+    
+    CommandPoolManager::~CommandPoolManager()
+    {
+        // Pools can not be destroyed while their command buffers are pending
+        for (auto& frame : frames_)
+        {
+            execution_manager_.Wait(frame.ticket);
+        }
+    }
+    
+    VkCommandBuffer CommandPoolManager::AllocateCommandBuffer(VkCommandBufferLevel level)
+    {
+        auto& thread_pool = GetThreadCommandPool();
+        auto& command_buffers = thread_pool.command_buffers[level];
+        auto& num_used = thread_pool.num_used[level];
+        
+        // Reset along with the pool, ready to be begun again
+        if (num_used < command_buffers.size())
+        {
+            return command_buffers[num_used++];
+        }
+        
+        VkCommandBufferAllocateInfo command_buffer_alloc_info;
+        command_buffer_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        command_buffer_alloc_info.pNext = nullptr;
+        command_buffer_alloc_info.commandPool = thread_pool.pool;
+        command_buffer_alloc_info.commandBufferCount = 1u;
+        command_buffer_alloc_info.level = level;
+        
+        VkCommandBuffer command_buffer = nullptr;
+        auto res = vkAllocateCommandBuffers(device_, &command_buffer_alloc_info, &command_buffer);
+        
+        if (res != VK_SUCCESS)
+        {
+            throw std::runtime_error("CommandPoolManager: Cannot allocate command buffer");
+        }
+        
+        command_buffers.push_back(command_buffer);
+        ++num_used;
+        
+        return command_buffer;
+    }
+    
+    void CommandPoolManager::EndFrame(Ticket ticket)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        frames_[current_frame_].ticket = ticket;
+        current_frame_ = (current_frame_ + 1u) % frames_.size();
+        
+        auto& frame = frames_[current_frame_];
+        
+        // Bounds the number of frames in flight
+        execution_manager_.Wait(frame.ticket);
+        
+        for (auto& iter : frame.pools)
+        {
+            auto& thread_pool = *iter.second;
+            
+            vkResetCommandPool(device_, thread_pool.pool, 0);
+            
+            for (auto level = 0u; level < kNumLevels; ++level)
+            {
+                thread_pool.num_used[level] = 0u;
+            }
+        }
+        
+        frame.ticket = 0u;
+    }
+    
+    CommandPoolManager::ThreadCommandPool& CommandPoolManager::GetThreadCommandPool()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        auto& pools = frames_[current_frame_].pools;
+        auto iter = pools.find(std::this_thread::get_id());
+        
+        if (iter != pools.end())
+        {
+            return *iter->second;
+        }
+        
+        // Buffers are only ever reset together with the pool
+        VkCommandPoolCreateInfo pool_create_info;
+        pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pool_create_info.pNext = nullptr;
+        pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        pool_create_info.queueFamilyIndex = queue_family_index_;
+        
+        VkCommandPool command_pool = nullptr;
+        auto res = vkCreateCommandPool(device_, &pool_create_info, nullptr, &command_pool);
+        
+        if (res != VK_SUCCESS)
+        {
+            throw std::runtime_error("CommandPoolManager: Cannot create command pool");
+        }
+        
+        auto device = device_;
+        std::unique_ptr<ThreadCommandPool> thread_pool(new ThreadCommandPool());
+        thread_pool->pool = VkScopedObject<VkCommandPool>(command_pool,
+                                                          [device](VkCommandPool pool)
+                                                          {
+                                                              vkDestroyCommandPool(device, pool, nullptr);
+                                                          });
+        
+        // Only entries with a live pool go into the map, EndFrame dereferences them all
+        return *pools.emplace(std::this_thread::get_id(), std::move(thread_pool)).first->second;
+    }
+}
@@ -0,0 +1,89 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_scoped_object.h"
+#include "vk_execution_manager.h"
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace vkw
+{
+    // Command pools per thread and per frame in flight. Command buffers of a
+    // frame are handed out from the calling thread's pool, when the frame comes
+    // around again its pools are reset in bulk with vkResetCommandPool and the
+    // command buffers reused instead of reallocated.
+    class CommandPoolManager
+    {
+    public:
+        static std::uint32_t constexpr kDefaultNumFrames = 3u;
+        
+        CommandPoolManager(VkDevice device,
+                           std::uint32_t queue_family_index,
+                           ExecutionManager& execution_manager,
+                           std::uint32_t num_frames = kDefaultNumFrames);
+        
+        ~CommandPoolManager();
+        
+        // Command buffer from the calling thread's pool for the current frame,
+        // valid until the frame is recycled
+        VkCommandBuffer AllocateCommandBuffer(VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+        
+        // Close the current frame, ticket covers all the work recorded in it.
+        // Recording threads must be done with the frame. Waits for the ticket
+        // of the frame about to be reused if it is still running.
+        void EndFrame(Ticket ticket);
+        
+        VkDevice GetDevice() const { return device_; }
+        std::uint32_t GetQueueFamilyIndex() const { return queue_family_index_; }
+        
+    private:
+        static std::uint32_t constexpr kNumLevels = 2u;
+        
+        struct ThreadCommandPool
+        {
+            VkScopedObject<VkCommandPool> pool;
+            std::vector<VkCommandBuffer> command_buffers[kNumLevels];
+            std::size_t num_used[kNumLevels] = { 0u, 0u };
+        };
+        
+        struct Frame
+        {
+            Ticket ticket = 0u;
+            std::unordered_map<std::thread::id, std::unique_ptr<ThreadCommandPool>> pools;
+        };
+        
+        ThreadCommandPool& GetThreadCommandPool();
+        
+        VkDevice device_;
+        std::uint32_t queue_family_index_;
+        ExecutionManager& execution_manager_;
+        
+        // Guards the frame maps, each ThreadCommandPool is only used by its own thread
+        std::mutex mutex_;
+        std::vector<Frame> frames_;
+        std::uint32_t current_frame_ = 0u;
+    };
+}
@@ -0,0 +1,229 @@
+#include "vk_compressed_upload.h"
+#include <algorithm>
+
+namespace vkw
+{
+    std::vector<std::uint32_t> CompressDeltaBitpack(std::uint32_t const* values, std::size_t count)
+    {
+        auto block_size = DeltaBitpackFormat::kBlockSize;
+        auto num_blocks = (std::uint32_t)((count + block_size - 1) / block_size);
+        
+        std::vector<std::uint32_t> stream(DeltaBitpackFormat::kHeaderSize +
+                                          num_blocks * DeltaBitpackFormat::kBlockHeaderSize, 0u);
+        
+        stream[0] = DeltaBitpackFormat::kMagic;
+        stream[1] = (std::uint32_t)count;
+        stream[2] = num_blocks;
+        
+        std::vector<std::uint32_t> zigzag(block_size);
+        std::uint32_t word_offset = 0u;
+        
+        for (auto block = 0u; block < num_blocks; ++block)
+        {
+            auto first = (std::size_t)block * block_size;
+            auto base = first > 0 ? values[first - 1] : 0u;
+            auto previous = base;
+            std::uint32_t bits = 0u;
+            
+            // Padding past the end of the data encodes as zero deltas
+            for (auto i = 0u; i < block_size; ++i)
+            {
+                auto value = first + i < count ? values[first + i] : previous;
+                auto delta = (std::int32_t)(value - previous);
+                zigzag[i] = ((std::uint32_t)delta << 1) ^ (std::uint32_t)(delta >> 31);
+                bits |= zigzag[i];
+                previous = value;
+            }
+            
+            std::uint32_t width = 0u;
+            while (width < 32u && (bits >> width) != 0u)
+            {
+                ++width;
+            }
+            
+            auto block_header = DeltaBitpackFormat::kHeaderSize + block * DeltaBitpackFormat::kBlockHeaderSize;
+            stream[block_header] = base;
+            stream[block_header + 1] = width;
+            stream[block_header + 2] = word_offset;
+            
+            auto num_words = (block_size * width + 31u) / 32u;
+            auto packed = stream.size();
+            stream.resize(packed + num_words, 0u);
+            
+            for (auto i = 0u; width != 0u && i < block_size; ++i)
+            {
+                auto bit = i * width;
+                auto word = packed + bit / 32u;
+                auto shift = bit % 32u;
+                
+                stream[word] |= zigzag[i] << shift;
+                
+                if (shift + width > 32u)
+                {
+                    stream[word + 1] |= zigzag[i] >> (32u - shift);
+                }
+            }
+            
+            word_offset += num_words;
+        }
+        
+        return stream;
+    }
+    
+    Decompressor::Decompressor(VkDevice device,
+                               ExecutionManager& execution_manager,
+                               MemoryManager& memory_manager,
+                               ShaderManager& shader_manager,
+                               PipelineManager& pipeline_manager,
+                               std::string const& shader_file_name)
+    : device_(device)
+    , memory_manager_(memory_manager)
+    , shader_(shader_manager.CreateShader(VK_SHADER_STAGE_COMPUTE_BIT, shader_file_name))
+    , pipeline_(pipeline_manager.CreateComputePipeline(shader_, DeltaBitpackFormat::kBlockSize, 1u, 1u))
+    , command_buffer_builder_(device, execution_manager.GetQueueFamilyIndex(QueueType::kGraphics), &execution_manager)
+    , execution_manager_(execution_manager)
+    {
+    }
+    
+    void Decompressor::ValidateStream(std::vector<std::uint32_t> const& stream)
+    {
+        if (stream.size() < DeltaBitpackFormat::kHeaderSize || stream[0] != DeltaBitpackFormat::kMagic)
+        {
+            throw std::runtime_error("Decompressor: Invalid compressed stream");
+        }
+        
+        auto num_values = (std::uint64_t)stream[1];
+        auto num_blocks = (std::uint64_t)stream[2];
+        
+        if (num_blocks != (num_values + DeltaBitpackFormat::kBlockSize - 1u) / DeltaBitpackFormat::kBlockSize)
+        {
+            throw std::runtime_error("Decompressor: Block count does not match the value count");
+        }
+        
+        auto packed = DeltaBitpackFormat::kHeaderSize + num_blocks * DeltaBitpackFormat::kBlockHeaderSize;
+        
+        if (packed > stream.size())
+        {
+            throw std::runtime_error("Decompressor: Compressed stream is truncated");
+        }
+        
+        for (std::uint64_t block = 0u; block < num_blocks; ++block)
+        {
+            auto block_header = DeltaBitpackFormat::kHeaderSize + block * DeltaBitpackFormat::kBlockHeaderSize;
+            auto width = (std::uint64_t)stream[block_header + 1];
+            auto word_offset = (std::uint64_t)stream[block_header + 2];
+            
+            if (width > 32u)
+            {
+                throw std::runtime_error("Decompressor: Invalid bit width in compressed stream");
+            }
+            
+            auto num_words = (DeltaBitpackFormat::kBlockSize * width + 31u) / 32u;
+            
+            if (packed + word_offset + num_words > stream.size())
+            {
+                throw std::runtime_error("Decompressor: Compressed stream is truncated");
+            }
+        }
+    }
+    
+    void Decompressor::WriteBufferCompressed(VkBuffer dst,
+                                             VkDeviceSize dst_size,
+                                             VkDeviceSize dst_offset,
+                                             std::vector<std::uint32_t> const& stream)
+    {
+        ValidateStream(stream);
+        
+        if (dst_offset % sizeof(std::uint32_t) != 0u)
+        {
+            throw std::runtime_error("Decompressor: Destination offset should be a multiple of 4");
+        }
+        
+        auto output_size = (VkDeviceSize)stream[1] * sizeof(std::uint32_t);
+        
+        if (dst_offset > dst_size || output_size > dst_size - dst_offset)
+        {
+            throw std::runtime_error("Decompressor: Decompressed data does not fit in the destination buffer");
+        }
+        
+        // The shader indexes dst in 32-bit words
+        if (dst_offset / sizeof(std::uint32_t) + stream[1] > 0xffffffffu)
+        {
+            throw std::runtime_error("Decompressor: Destination range is too large");
+        }
+        
+        auto stream_size = (VkDeviceSize)(stream.size() * sizeof(std::uint32_t));
+        
+        if (stream_size > stream_buffer_size_)
+        {
+            stream_buffer_ = memory_manager_.CreateBuffer(stream_size,
+                                                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                          VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+            stream_buffer_size_ = stream_size;
+        }
+        
+        // Only the compressed bytes cross the bus
+        memory_manager_.WriteBuffer(stream_buffer_, 0u, stream_size, stream.data());
+        
+        shader_.SetArg(0u, stream_buffer_);
+        shader_.SetArg(1u, dst);
+        
+        std::vector<std::uint32_t> header(stream.cbegin(), stream.cbegin() + DeltaBitpackFormat::kHeaderSize);
+        header[3] = (std::uint32_t)(dst_offset / sizeof(std::uint32_t));
+        auto header_size = (VkDeviceSize)(header.size() * sizeof(std::uint32_t));
+        
+        auto num_blocks = stream[2];
+        
+        command_buffer_builder_.BeginCommandBuffer();
+        
+        // Large streams are expanded in several dispatches, the block offset
+        // of each one is patched into the header in the command stream
+        for (std::uint32_t block_offset = 0u; block_offset < num_blocks; block_offset += kMaxGroupsPerDispatch)
+        {
+            header[4] = block_offset;
+            
+            if (block_offset > 0u)
+            {
+                command_buffer_builder_.Barrier(stream_buffer_,
+                                                VK_ACCESS_SHADER_READ_BIT,
+                                                VK_ACCESS_TRANSFER_WRITE_BIT,
+                                                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                                0u,
+                                                header_size);
+            }
+            
+            command_buffer_builder_.UpdateBuffer(stream_buffer_,
+                                                 0u,
+                                                 header_size,
+                                                 header.data());
+            
+            command_buffer_builder_.Barrier(stream_buffer_,
+                                            VK_ACCESS_TRANSFER_WRITE_BIT,
+                                            VK_ACCESS_SHADER_READ_BIT,
+                                            VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                            0u,
+                                            header_size);
+            
+            command_buffer_builder_.Dispatch(pipeline_,
+                                             shader_,
+                                             std::min(kMaxGroupsPerDispatch, num_blocks - block_offset),
+                                             1u,
+                                             1u);
+        }
+        
+        command_buffer_builder_.Barrier(dst,
+                                        VK_ACCESS_SHADER_WRITE_BIT,
+                                        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+                                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                        dst_offset,
+                                        stream[1] * sizeof(std::uint32_t));
+        
+        auto command_buffer = command_buffer_builder_.EndCommandBuffer();
+        auto ticket = execution_manager_.Submit(command_buffer);
+        execution_manager_.Wait(ticket);
+    }
+}
@@ -0,0 +1,91 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_scoped_object.h"
+#include "vk_memory_manager.h"
+#include "vk_shader_manager.h"
+#include "vk_pipeline_manager.h"
+#include "vk_command_buffer_builder.h"
+#include "vk_execution_manager.h"
+#include <vector>
+#include <string>
+
+namespace vkw
+{
+    // Delta + bitpack compressed stream of 32-bit values, all fields are uint32:
+    //
+    //   header        kHeaderSize words: magic, num_values, num_blocks,
+    //                 dst_offset (words), block_offset, reserved...
+    //   block table   kBlockHeaderSize words per block: base, bit width, word offset
+    //   packed data   per block kBlockSize zigzag deltas, bit width bits each, LSB first
+    //
+    // value[i] = base + sum of deltas [0..i] within the block, so blocks decode
+    // independently. dst_offset and block_offset are filled in by the uploader.
+    struct DeltaBitpackFormat
+    {
+        static std::uint32_t constexpr kMagic = 0x50444b56u; // "VKDP"
+        static std::uint32_t constexpr kHeaderSize = 8u;
+        static std::uint32_t constexpr kBlockHeaderSize = 3u;
+        static std::uint32_t constexpr kBlockSize = 256u;
+    };
+    
+    // Host side encoder for the format above
+    std::vector<std::uint32_t> CompressDeltaBitpack(std::uint32_t const* values, std::size_t count);
+    
+    // Uploads compressed streams and expands them on the GPU with
+    // decompress.comp, the host never touches the uncompressed data.
+    class Decompressor
+    {
+    public:
+        Decompressor(VkDevice device,
+                     ExecutionManager& execution_manager,
+                     MemoryManager& memory_manager,
+                     ShaderManager& shader_manager,
+                     PipelineManager& pipeline_manager,
+                     std::string const& shader_file_name = "decompress.comp.spv");
+        
+        // Upload the stream and decompress it into dst starting at dst_offset
+        // (multiple of 4), dst needs STORAGE_BUFFER usage. Blocks until done.
+        // Throws if the stream is truncated or its values do not fit in dst_size.
+        void WriteBufferCompressed(VkBuffer dst,
+                                   VkDeviceSize dst_size,
+                                   VkDeviceSize dst_offset,
+                                   std::vector<std::uint32_t> const& stream);
+        
+    private:
+        // Maximum number of workgroups per dispatch guaranteed by the spec
+        static std::uint32_t constexpr kMaxGroupsPerDispatch = 65535u;
+        
+        // The shader trusts the stream, check everything it reads on the host
+        static void ValidateStream(std::vector<std::uint32_t> const& stream);
+        
+        VkDevice device_;
+        MemoryManager& memory_manager_;
+        Shader shader_;
+        ComputePipeline pipeline_;
+        CommandBufferBuilder command_buffer_builder_;
+        ExecutionManager& execution_manager_;
+        VkScopedObject<VkBuffer> stream_buffer_;
+        VkDeviceSize stream_buffer_size_ = 0u;
+    };
+}
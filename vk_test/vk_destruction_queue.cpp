@@ -0,0 +1,96 @@
+#include "vk_destruction_queue.h"
+#include <algorithm>
+#include <iterator>
+
+namespace vkw
+{
+    DestructionQueue::DestructionQueue(ExecutionManager& execution_manager)
+    : execution_manager_(execution_manager)
+    {
+    }
+    
+    DestructionQueue::~DestructionQueue()
+    {
+        Flush();
+    }
+    
+    void DestructionQueue::Enqueue(std::shared_ptr<void> object, std::vector<Ticket> const& tickets)
+    {
+        auto collect = false;
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            if (batches_.empty() || batches_.back().tickets != tickets)
+            {
+                batches_.push_back({ tickets, {} });
+            }
+            
+            batches_.back().objects.push_back(std::move(object));
+            ++num_pending_;
+            
+            collect = batches_.size() >= kCollectThreshold;
+        }
+        
+        if (collect)
+        {
+            Collect();
+        }
+    }
+    
+    void DestructionQueue::Collect()
+    {
+        std::vector<Batch> completed;
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            // Tickets of different queues complete out of order, check every batch
+            auto iter = std::stable_partition(batches_.begin(), batches_.end(),
+                                              [this](Batch const& batch)
+                                              {
+                                                  return !std::all_of(batch.tickets.cbegin(), batch.tickets.cend(),
+                                                                      [this](Ticket ticket)
+                                                                      {
+                                                                          return execution_manager_.IsComplete(ticket);
+                                                                      });
+                                              });
+            
+            std::move(iter, batches_.end(), std::back_inserter(completed));
+            batches_.erase(iter, batches_.end());
+            
+            for (auto& batch : completed)
+            {
+                num_pending_ -= batch.objects.size();
+            }
+        }
+        
+        // Deleters run outside of the lock
+        completed.clear();
+    }
+    
+    void DestructionQueue::Flush()
+    {
+        std::vector<Batch> batches;
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            batches.swap(batches_);
+            num_pending_ = 0u;
+        }
+        
+        for (auto& batch : batches)
+        {
+            for (auto ticket : batch.tickets)
+            {
+                execution_manager_.Wait(ticket);
+            }
+        }
+    }
+    
+    std::size_t DestructionQueue::GetNumPending() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return num_pending_;
+    }
+}
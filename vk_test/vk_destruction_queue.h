@@ -0,0 +1,100 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_scoped_object.h"
+#include "vk_execution_manager.h"
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace vkw
+{
+    // Keeps objects alive until the GPU is done with them. Released objects
+    // (scoped buffers, images, descriptor sets, command buffers, pipelines,
+    // shaders, anything movable) are queued against tickets and destroyed in
+    // batches by Collect once all of those tickets are complete, so letting
+    // go of a resource never needs a WaitIdle.
+    class DestructionQueue
+    {
+    public:
+        // Release collects on its own once this many batches are pending, so it
+        // runs deleters as well
+        static std::size_t constexpr kCollectThreshold = 64u;
+        
+        explicit DestructionQueue(ExecutionManager& execution_manager);
+        
+        // Waits for and destroys everything still queued
+        ~DestructionQueue();
+        
+        DestructionQueue(DestructionQueue const&) = delete;
+        DestructionQueue& operator=(DestructionQueue const&) = delete;
+        
+        // Destroyed once the tickets are complete
+        template <typename T>
+        void Release(T&& object, std::vector<Ticket> const& tickets);
+        
+        template <typename T>
+        void Release(T&& object, Ticket ticket) { Release(std::forward<T>(object), std::vector<Ticket>(1u, ticket)); }
+        
+        // Against every submission made so far
+        template <typename T>
+        void Release(T&& object) { Release(std::forward<T>(object), execution_manager_.GetLastTickets()); }
+        
+        // Destroy the objects whose tickets are complete, once a frame is a good
+        // pace. The queue itself is thread safe but the deleters are not: objects
+        // from the MemoryManager must be released and collected on its thread.
+        void Collect();
+        
+        // Wait for all the tickets and destroy everything
+        void Flush();
+        
+        std::size_t GetNumPending() const;
+        
+    private:
+        // Objects released against the same tickets in a row
+        struct Batch
+        {
+            std::vector<Ticket> tickets;
+            std::vector<std::shared_ptr<void>> objects;
+        };
+        
+        void Enqueue(std::shared_ptr<void> object, std::vector<Ticket> const& tickets);
+        
+        ExecutionManager& execution_manager_;
+        
+        mutable std::mutex mutex_;
+        std::vector<Batch> batches_;
+        std::size_t num_pending_ = 0u;
+    };
+    
+    template <typename T>
+    inline void DestructionQueue::Release(T&& object, std::vector<Ticket> const& tickets)
+    {
+        static_assert(!std::is_lvalue_reference<T>::value, "DestructionQueue: Release takes ownership, std::move the object");
+        
+        // Type erased, the shared_ptr runs the right destructor
+        Enqueue(std::make_shared<typename std::decay<T>::type>(std::move(object)), tickets);
+    }
+}
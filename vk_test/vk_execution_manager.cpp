@@ -1,30 +1,644 @@
 #include "vk_execution_manager.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <utility>
 
 namespace vkw
 {
-    void ExecutionManager::Submit(VkCommandBuffer buffer)
+    ExecutionManager::ExecutionManager(VkDevice device, std::uint32_t queue_family_index)
+    : device_(device)
+    , batching_(false)
     {
-        VkSubmitInfo submit_info;
-        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submit_info.pNext = nullptr;
-        submit_info.commandBufferCount = 1u;
-        submit_info.pCommandBuffers = &buffer;
-        submit_info.pSignalSemaphores = nullptr;
-        submit_info.signalSemaphoreCount = 0u;
-        submit_info.pWaitSemaphores = nullptr;
-        submit_info.waitSemaphoreCount = 0u;
-        submit_info.pWaitDstStageMask = nullptr;
+        DeviceQueues device_queues;
         
-        VkQueue queue = nullptr;
-        vkGetDeviceQueue(device_, queue_family_index_, 0u, &queue);
+        for (auto i = 0u; i < kNumQueueTypes; ++i)
+        {
+            device_queues.family_index[i] = queue_family_index;
+            device_queues.queue_count[i] = 1u;
+            device_queues.high_priority_queue[i] = kNoQueue;
+        }
         
-        vkQueueSubmit(queue, 1u, &submit_info, VK_NULL_HANDLE);
+        Init(device_queues);
+    }
+    
+    ExecutionManager::ExecutionManager(VkDevice device, DeviceQueues const& device_queues)
+    : device_(device)
+    , batching_(false)
+    {
+        Init(device_queues);
+    }
+    
+    ExecutionManager::~ExecutionManager()
+    {
+        // Fences and semaphores can not go away while in use
+        WaitIdle();
+    }
+    
+    void ExecutionManager::Init(DeviceQueues const& device_queues)
+    {
+        auto device = device_;
+        
+        ResetStats();
+        
+#ifdef VK_KHR_timeline_semaphore
+        // Entry points are only there if the device was created with the extension
+        get_semaphore_counter_value_ = (PFN_vkGetSemaphoreCounterValueKHR)
+            vkGetDeviceProcAddr(device_, "vkGetSemaphoreCounterValueKHR");
+        wait_semaphores_ = (PFN_vkWaitSemaphoresKHR)
+            vkGetDeviceProcAddr(device_, "vkWaitSemaphoresKHR");
+        
+        use_timeline_semaphore_ = get_semaphore_counter_value_ && wait_semaphores_;
+#endif
+        
+        // (family, queue index) -> queue id
+        std::map<std::pair<std::uint32_t, std::uint32_t>, std::uint32_t> queue_ids;
+        
+        for (auto type = 0u; type < kNumQueueTypes; ++type)
+        {
+            auto family_index = device_queues.family_index[type];
+            auto queue_count = std::max(1u, device_queues.queue_count[type]);
+            
+            type_family_index_[type] = family_index;
+            type_high_priority_queue_[type] = device_queues.high_priority_queue[type] < queue_count ?
+                                              device_queues.high_priority_queue[type] : kNoQueue;
+            
+            for (auto i = 0u; i < queue_count; ++i)
+            {
+                auto iter = queue_ids.find(std::make_pair(family_index, i));
+                
+                if (iter != queue_ids.cend())
+                {
+                    type_queues_[type].push_back(iter->second);
+                    continue;
+                }
+                
+                std::unique_ptr<Queue> queue(new Queue());
+                queue->family_index = family_index;
+                queue->last_completed = 0u;
+                vkGetDeviceQueue(device_, family_index, i, &queue->queue);
+                
+                VkCommandPoolCreateInfo pool_create_info;
+                pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                pool_create_info.pNext = nullptr;
+                pool_create_info.flags = 0;
+                pool_create_info.queueFamilyIndex = family_index;
+                
+                VkCommandPool command_pool = nullptr;
+                auto res = vkCreateCommandPool(device_, &pool_create_info, nullptr, &command_pool);
+                
+                if (res != VK_SUCCESS)
+                {
+                    throw std::runtime_error("ExecutionManager: Cannot create command pool");
+                }
+                
+                queue->command_pool = VkScopedObject<VkCommandPool>(command_pool,
+                                                                    [device](VkCommandPool pool)
+                                                                    {
+                                                                        vkDestroyCommandPool(device, pool, nullptr);
+                                                                    });
+                
+#ifdef VK_KHR_timeline_semaphore
+                if (use_timeline_semaphore_)
+                {
+                    VkSemaphoreTypeCreateInfoKHR type_create_info;
+                    type_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+                    type_create_info.pNext = nullptr;
+                    type_create_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+                    type_create_info.initialValue = 0u;
+                    
+                    VkSemaphoreCreateInfo semaphore_create_info;
+                    semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+                    semaphore_create_info.pNext = &type_create_info;
+                    semaphore_create_info.flags = 0;
+                    
+                    VkSemaphore semaphore = nullptr;
+                    res = vkCreateSemaphore(device_, &semaphore_create_info, nullptr, &semaphore);
+                    
+                    if (res != VK_SUCCESS)
+                    {
+                        throw std::runtime_error("ExecutionManager: Cannot create timeline semaphore");
+                    }
+                    
+                    queue->timeline_semaphore = VkScopedObject<VkSemaphore>(semaphore,
+                                                                            [device](VkSemaphore semaphore)
+                                                                            {
+                                                                                vkDestroySemaphore(device, semaphore, nullptr);
+                                                                            });
+                }
+#endif
+                
+                auto queue_id = (std::uint32_t)queues_.size();
+                queues_.push_back(std::move(queue));
+                queue_ids[std::make_pair(family_index, i)] = queue_id;
+                type_queues_[type].push_back(queue_id);
+            }
+        }
+        
+        last_tickets_.assign(queues_.size(), 0u);
+    }
+    
+    Ticket ExecutionManager::Submit(VkCommandBuffer buffer, std::vector<Ticket> const& wait_tickets)
+    {
+        return Submit(buffer, QueueType::kGraphics, wait_tickets, 0u);
+    }
+    
+    Ticket ExecutionManager::Submit(VkCommandBuffer buffer,
+                                    QueueType type,
+                                    std::vector<Ticket> const& wait_tickets,
+                                    std::uint32_t queue_index)
+    {
+        auto& type_queues = type_queues_[(std::uint32_t)type];
+        
+        if (queue_index >= type_queues.size())
+        {
+            throw std::runtime_error("ExecutionManager: Queue index out of range");
+        }
+        
+        auto queue_id = type_queues[queue_index];
+        auto& queue = *queues_[queue_id];
+        
+        // Latest value to wait for on each queue
+        std::vector<std::uint64_t> wait_values(queues_.size(), 0u);
+        
+        for (auto ticket : wait_tickets)
+        {
+            TicketRecord record;
+            
+            if (ResolveTicket(ticket, record))
+            {
+                wait_values[record.queue] = std::max(wait_values[record.queue], record.value);
+            }
+        }
+        
+        for (auto i = 0u; i < queues_.size(); ++i)
+        {
+            if (i == queue_id || wait_values[i] == 0u)
+            {
+                continue;
+            }
+            
+            auto& other_queue = *queues_[i];
+            
+            // The awaited work has to be on the device before anything can wait on it
+            {
+                std::lock_guard<std::mutex> lock(other_queue.mutex);
+                
+                if (wait_values[i] > other_queue.last_flushed)
+                {
+                    FlushQueue(other_queue);
+                }
+            }
+            
+            // Without timelines there is nothing to wait on across queues
+            // from the device, wait on the host instead
+            if (!use_timeline_semaphore_)
+            {
+                WaitValue(other_queue, wait_values[i]);
+            }
+        }
+        
+        ++num_submits_;
+        
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        
+        auto value = ++queue.last_submitted;
+        
+        BatchEntry entry;
+        entry.value = value;
+        
+        if (use_timeline_semaphore_)
+        {
+            for (auto i = 0u; i < queues_.size(); ++i)
+            {
+                if (wait_values[i] > 0u)
+                {
+                    entry.wait_semaphores.push_back(queues_[i]->timeline_semaphore);
+                    entry.wait_values.push_back(wait_values[i]);
+                    entry.wait_stages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+                }
+            }
+        }
+        else
+        {
+            RetireCompleted(queue);
+            
+            // Same queue: a full barrier ahead of the command buffer orders it
+            // after everything submitted before, including the awaited work
+            if (wait_values[queue_id] > queue.last_completed)
+            {
+                entry.command_buffers.push_back(GetBarrierCommandBuffer(queue));
+            }
+        }
+        
+        entry.command_buffers.push_back(buffer);
+        queue.batch.push_back(std::move(entry));
+        
+        if (!batching_ || queue.batch.size() >= kMaxBatchSize)
+        {
+            FlushQueue(queue);
+        }
+        
+        // Still under the queue lock: tickets of a queue must follow its values,
+        // or the last ticket could miss later work
+        std::lock_guard<std::mutex> tickets_lock(tickets_mutex_);
+        
+        ticket_records_.push_back({ queue_id, value });
+        auto ticket = first_record_ticket_ + ticket_records_.size() - 1u;
+        last_tickets_[queue_id] = ticket;
+        
+        // Forget tickets known to be complete
+        while (!ticket_records_.empty() &&
+               ticket_records_.front().value <= queues_[ticket_records_.front().queue]->last_completed)
+        {
+            ticket_records_.pop_front();
+            ++first_record_ticket_;
+        }
+        
+        return ticket;
+    }
+    
+    bool ExecutionManager::IsComplete(Ticket ticket)
+    {
+        TicketRecord record;
+        
+        if (!ResolveTicket(ticket, record))
+        {
+            return true;
+        }
+        
+        auto& queue = *queues_[record.queue];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        
+        // Somebody is interested, do not let it sit in the batch
+        if (record.value > queue.last_flushed)
+        {
+            FlushQueue(queue);
+            return false;
+        }
+        
+        return IsValueComplete(queue, record.value);
+    }
+    
+    void ExecutionManager::Wait(Ticket ticket)
+    {
+        TicketRecord record;
+        
+        if (ResolveTicket(ticket, record))
+        {
+            WaitValue(*queues_[record.queue], record.value);
+        }
     }
     
     void ExecutionManager::WaitIdle()
     {
-        VkQueue queue = nullptr;
-        vkGetDeviceQueue(device_, queue_family_index_, 0u, &queue);
-        vkQueueWaitIdle(queue);
+        for (auto& queue : queues_)
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            
+            FlushQueue(*queue);
+            vkQueueWaitIdle(queue->queue);
+            
+            RetireCompleted(*queue);
+            queue->last_completed = queue->last_submitted;
+        }
+    }
+    
+    void ExecutionManager::SetBatching(bool enable)
+    {
+        batching_ = enable;
+        
+        if (!enable)
+        {
+            Flush();
+        }
+    }
+    
+    void ExecutionManager::Flush()
+    {
+        for (auto& queue : queues_)
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            FlushQueue(*queue);
+        }
+    }
+    
+    SubmitStats ExecutionManager::GetStats() const
+    {
+        SubmitStats stats;
+        stats.num_submits = num_submits_;
+        stats.num_queue_submits = num_queue_submits_;
+        stats.queue_submit_time = queue_submit_time_ns_ * 1e-9;
+        return stats;
+    }
+    
+    void ExecutionManager::ResetStats()
+    {
+        num_submits_ = 0u;
+        num_queue_submits_ = 0u;
+        queue_submit_time_ns_ = 0u;
+    }
+    
+    void ExecutionManager::FlushQueue(Queue& queue)
+    {
+        if (queue.batch.empty())
+        {
+            return;
+        }
+        
+        std::vector<VkSubmitInfo> submit_infos(queue.batch.size());
+        
+#ifdef VK_KHR_timeline_semaphore
+        std::vector<VkTimelineSemaphoreSubmitInfoKHR> timeline_submit_infos(queue.batch.size());
+#endif
+        
+        for (auto i = 0u; i < queue.batch.size(); ++i)
+        {
+            auto& entry = queue.batch[i];
+            auto& submit_info = submit_infos[i];
+            
+            submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submit_info.pNext = nullptr;
+            submit_info.commandBufferCount = (std::uint32_t)entry.command_buffers.size();
+            submit_info.pCommandBuffers = entry.command_buffers.data();
+            submit_info.pSignalSemaphores = nullptr;
+            submit_info.signalSemaphoreCount = 0u;
+            submit_info.waitSemaphoreCount = (std::uint32_t)entry.wait_semaphores.size();
+            submit_info.pWaitSemaphores = entry.wait_semaphores.data();
+            submit_info.pWaitDstStageMask = entry.wait_stages.data();
+            
+#ifdef VK_KHR_timeline_semaphore
+            if (use_timeline_semaphore_)
+            {
+                auto& timeline_submit_info = timeline_submit_infos[i];
+                timeline_submit_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+                timeline_submit_info.pNext = nullptr;
+                timeline_submit_info.waitSemaphoreValueCount = (std::uint32_t)entry.wait_values.size();
+                timeline_submit_info.pWaitSemaphoreValues = entry.wait_values.data();
+                timeline_submit_info.signalSemaphoreValueCount = 1u;
+                timeline_submit_info.pSignalSemaphoreValues = &entry.value;
+                
+                submit_info.pNext = &timeline_submit_info;
+                submit_info.signalSemaphoreCount = 1u;
+                submit_info.pSignalSemaphores = queue.timeline_semaphore.GetObjectPtr();
+            }
+#endif
+        }
+        
+        // One fence covers the whole batch
+        FencePtr fence;
+        
+        if (!use_timeline_semaphore_)
+        {
+            fence = AcquireFence(queue);
+        }
+        
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        auto res = vkQueueSubmit(queue.queue,
+                                 (std::uint32_t)submit_infos.size(),
+                                 submit_infos.data(),
+                                 fence ? (VkFence)*fence : VK_NULL_HANDLE);
+        
+        auto elapsed = std::chrono::high_resolution_clock::now() - start;
+        queue_submit_time_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        ++num_queue_submits_;
+        
+        if (res != VK_SUCCESS)
+        {
+            throw std::runtime_error("ExecutionManager: Queue submission failed");
+        }
+        
+        if (fence)
+        {
+            for (auto& entry : queue.batch)
+            {
+                queue.pending.push_back({ entry.value, fence });
+            }
+        }
+        
+        queue.last_flushed = queue.batch.back().value;
+        queue.batch.clear();
+    }
+    
+    std::vector<Ticket> ExecutionManager::GetLastTickets()
+    {
+        std::lock_guard<std::mutex> lock(tickets_mutex_);
+        
+        std::vector<Ticket> tickets;
+        
+        for (auto ticket : last_tickets_)
+        {
+            if (ticket >= first_record_ticket_)
+            {
+                tickets.push_back(ticket);
+            }
+        }
+        
+        return tickets;
+    }
+    
+    std::uint32_t ExecutionManager::GetQueueCount(QueueType type) const
+    {
+        return (std::uint32_t)type_queues_[(std::uint32_t)type].size();
+    }
+    
+    std::uint32_t ExecutionManager::GetQueueFamilyIndex(QueueType type) const
+    {
+        return type_family_index_[(std::uint32_t)type];
+    }
+    
+    std::uint32_t ExecutionManager::GetHighPriorityQueue(QueueType type) const
+    {
+        return type_high_priority_queue_[(std::uint32_t)type];
+    }
+    
+    bool ExecutionManager::ResolveTicket(Ticket ticket, TicketRecord& record)
+    {
+        std::lock_guard<std::mutex> lock(tickets_mutex_);
+        
+        if (ticket < first_record_ticket_)
+        {
+            return false;
+        }
+        
+        if (ticket - first_record_ticket_ >= ticket_records_.size())
+        {
+            throw std::runtime_error("ExecutionManager: Ticket not submitted yet");
+        }
+        
+        record = ticket_records_[ticket - first_record_ticket_];
+        return true;
+    }
+    
+    bool ExecutionManager::IsValueComplete(Queue& queue, std::uint64_t value)
+    {
+        if (value <= queue.last_completed)
+        {
+            return true;
+        }
+        
+        if (use_timeline_semaphore_)
+        {
+#ifdef VK_KHR_timeline_semaphore
+            std::uint64_t counter = 0u;
+            get_semaphore_counter_value_(device_, queue.timeline_semaphore, &counter);
+            queue.last_completed = std::max<std::uint64_t>(queue.last_completed, counter);
+#endif
+        }
+        else
+        {
+            RetireCompleted(queue);
+        }
+        
+        return value <= queue.last_completed;
+    }
+    
+    void ExecutionManager::WaitValue(Queue& queue, std::uint64_t value)
+    {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        
+        if (value > queue.last_flushed)
+        {
+            FlushQueue(queue);
+        }
+        
+        if (IsValueComplete(queue, value))
+        {
+            return;
+        }
+        
+        if (use_timeline_semaphore_)
+        {
+#ifdef VK_KHR_timeline_semaphore
+            lock.unlock();
+            
+            VkSemaphoreWaitInfoKHR wait_info;
+            wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+            wait_info.pNext = nullptr;
+            wait_info.flags = 0;
+            wait_info.semaphoreCount = 1u;
+            wait_info.pSemaphores = queue.timeline_semaphore.GetObjectPtr();
+            wait_info.pValues = &value;
+            
+            wait_semaphores_(device_, &wait_info, std::numeric_limits<std::uint64_t>::max());
+            
+            lock.lock();
+            queue.last_completed = std::max<std::uint64_t>(queue.last_completed, value);
+#endif
+        }
+        else
+        {
+            // Values in flight are consecutive. Holding a reference keeps the
+            // fence from being recycled while we wait on it unlocked.
+            auto fence = queue.pending[value - queue.pending.front().value].fence;
+            
+            lock.unlock();
+            vkWaitForFences(device_, 1u, fence->GetObjectPtr(), VK_TRUE, std::numeric_limits<std::uint64_t>::max());
+            lock.lock();
+            
+            RetireCompleted(queue);
+        }
+    }
+    
+    ExecutionManager::FencePtr ExecutionManager::AcquireFence(Queue& queue)
+    {
+        if (!queue.free_fences.empty())
+        {
+            auto fence = queue.free_fences.back();
+            queue.free_fences.pop_back();
+            vkResetFences(device_, 1u, fence->GetObjectPtr());
+            return fence;
+        }
+        
+        VkFenceCreateInfo fence_create_info;
+        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fence_create_info.pNext = nullptr;
+        fence_create_info.flags = 0;
+        
+        VkFence fence = nullptr;
+        auto res = vkCreateFence(device_, &fence_create_info, nullptr, &fence);
+        
+        if (res != VK_SUCCESS)
+        {
+            throw std::runtime_error("ExecutionManager: Cannot create fence");
+        }
+        
+        auto device = device_;
+        return std::make_shared<VkScopedObject<VkFence>>(fence,
+                                                         [device](VkFence fence)
+                                                         {
+                                                             vkDestroyFence(device, fence, nullptr);
+                                                         });
+    }
+    
+    void ExecutionManager::RetireCompleted(Queue& queue)
+    {
+        // A signaled fence also means every earlier submission on the queue is done
+        while (!queue.pending.empty() && vkGetFenceStatus(device_, *queue.pending.front().fence) == VK_SUCCESS)
+        {
+            auto& submit = queue.pending.front();
+            queue.last_completed = std::max<std::uint64_t>(queue.last_completed, submit.value);
+            
+            // Fences shared with the rest of their batch or somebody still
+            // waits on are not recycled yet
+            if (submit.fence.use_count() == 1)
+            {
+                queue.free_fences.push_back(std::move(submit.fence));
+            }
+            
+            queue.pending.pop_front();
+        }
+    }
+    
+    VkCommandBuffer ExecutionManager::GetBarrierCommandBuffer(Queue& queue)
+    {
+        if (queue.barrier_command_buffer)
+        {
+            return queue.barrier_command_buffer;
+        }
+        
+        VkCommandBufferAllocateInfo command_buffer_alloc_info;
+        command_buffer_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        command_buffer_alloc_info.pNext = nullptr;
+        command_buffer_alloc_info.commandPool = queue.command_pool;
+        command_buffer_alloc_info.commandBufferCount = 1u;
+        command_buffer_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        
+        auto res = vkAllocateCommandBuffers(device_, &command_buffer_alloc_info, &queue.barrier_command_buffer);
+        
+        if (res != VK_SUCCESS)
+        {
+            throw std::runtime_error("ExecutionManager: Cannot allocate command buffer");
+        }
+        
+        // Recorded once, resubmitted whenever a dependency is still pending
+        VkCommandBufferBeginInfo begin_info;
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.pNext = nullptr;
+        begin_info.pInheritanceInfo = nullptr;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        
+        vkBeginCommandBuffer(queue.barrier_command_buffer, &begin_info);
+        
+        VkMemoryBarrier barrier;
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.pNext = nullptr;
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        
+        vkCmdPipelineBarrier(queue.barrier_command_buffer,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             0,
+                             1u, &barrier,
+                             0u, nullptr,
+                             0u, nullptr);
+        
+        vkEndCommandBuffer(queue.barrier_command_buffer);
+        
+        return queue.barrier_command_buffer;
     }
 }
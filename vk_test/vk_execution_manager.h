@@ -24,23 +24,188 @@
 #include "vk_scoped_object.h"
 #include <unordered_map>
 #include <list>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace vkw
 {
+    // Monotonically increasing id of a submission, ticket 0 is always complete
+    using Ticket = std::uint64_t;
+    
+    enum class QueueType
+    {
+        kGraphics = 0,
+        kCompute,
+        kTransfer
+    };
+    
+    static std::uint32_t constexpr kNumQueueTypes = 3u;
+    static std::uint32_t constexpr kNoQueue = ~0u;
+    
+    // Queue family serving each QueueType and the number of queues created in it.
+    // Types without a dedicated family point to the same family as another type.
+    // high_priority_queue is the index of a queue created with a higher priority
+    // than the others in the family, kNoQueue if they all share one.
+    struct DeviceQueues
+    {
+        std::uint32_t family_index[kNumQueueTypes];
+        std::uint32_t queue_count[kNumQueueTypes];
+        std::uint32_t high_priority_queue[kNumQueueTypes];
+    };
+    
+    struct SubmitStats
+    {
+        std::uint64_t num_submits;       // Submit calls
+        std::uint64_t num_queue_submits; // vkQueueSubmit calls
+        double queue_submit_time;        // CPU seconds spent in vkQueueSubmit
+    };
+    
     class ExecutionManager
     {
     public:
-        ExecutionManager(VkDevice device, std::uint32_t queue_family_index)
-        : device_(device)
-        , queue_family_index_(queue_family_index)
-        {
-        }
+        // Single queue for every type of work
+        ExecutionManager(VkDevice device, std::uint32_t queue_family_index);
+        
+        ExecutionManager(VkDevice device, DeviceQueues const& device_queues);
+        
+        ~ExecutionManager();
+        
+        // Submit to queue queue_index of the family serving the type. The
+        // submission starts after the work of wait_tickets is done, waits
+        // on tickets of other queues turn into semaphore waits.
+        Ticket Submit(VkCommandBuffer buffer,
+                      QueueType type,
+                      std::vector<Ticket> const& wait_tickets = std::vector<Ticket>(),
+                      std::uint32_t queue_index = 0u);
         
-        void Submit(VkCommandBuffer buffer);
+        // Graphics queue 0
+        Ticket Submit(VkCommandBuffer buffer,
+                      std::vector<Ticket> const& wait_tickets = std::vector<Ticket>());
+        
+        // Both are safe to call from any thread
+        bool IsComplete(Ticket ticket);
+        void Wait(Ticket ticket);
+        
+        // Drains all the queues, prefer Wait(ticket)
         void WaitIdle();
         
+        // Latest ticket of every queue that has been submitted to, once all of
+        // them are complete so is every submission made so far
+        std::vector<Ticket> GetLastTickets();
+        
+        // With batching on, Submit only queues the command buffer. Pending
+        // submissions of a queue go out as one vkQueueSubmit on Flush, when
+        // one of their tickets is waited on or polled, or once kMaxBatchSize
+        // of them pile up.
+        void SetBatching(bool enable);
+        bool IsBatching() const { return batching_; }
+        
+        void Flush();
+        
+        SubmitStats GetStats() const;
+        void ResetStats();
+        
+        std::uint32_t GetQueueCount(QueueType type) const;
+        std::uint32_t GetQueueFamilyIndex(QueueType type) const;
+        
+        // Queue index for latency sensitive work or kNoQueue
+        std::uint32_t GetHighPriorityQueue(QueueType type) const;
+        
+        // Tickets are backed by timeline semaphores when VK_KHR_timeline_semaphore
+        // is enabled on the device and by pooled fences otherwise
+        bool UsesTimelineSemaphore() const { return use_timeline_semaphore_; }
+        
+        static std::size_t constexpr kMaxBatchSize = 64u;
+        
     private:
+        using FencePtr = std::shared_ptr<VkScopedObject<VkFence>>;
+        
+        struct PendingSubmit
+        {
+            std::uint64_t value;
+            FencePtr fence;
+        };
+        
+        // Submission waiting in a batch, arrays are kept for VkSubmitInfo
+        struct BatchEntry
+        {
+            std::vector<VkCommandBuffer> command_buffers;
+            std::vector<VkSemaphore> wait_semaphores;
+            std::vector<std::uint64_t> wait_values;
+            std::vector<VkPipelineStageFlags> wait_stages;
+            std::uint64_t value;
+        };
+        
+        // Submissions are counted per queue, tickets map to (queue, value)
+        struct Queue
+        {
+            VkQueue queue = VK_NULL_HANDLE;
+            std::uint32_t family_index = 0u;
+            
+            // Guards the queue and everything below
+            std::mutex mutex;
+            std::uint64_t last_submitted = 0u;
+            std::uint64_t last_flushed = 0u;
+            std::atomic<std::uint64_t> last_completed;
+            
+            std::vector<BatchEntry> batch;
+            
+            VkScopedObject<VkSemaphore> timeline_semaphore;
+            
+            // Fence mode, submissions in flight in submission order
+            std::deque<PendingSubmit> pending;
+            std::vector<FencePtr> free_fences;
+            VkScopedObject<VkCommandPool> command_pool;
+            VkCommandBuffer barrier_command_buffer = VK_NULL_HANDLE;
+        };
+        
+        struct TicketRecord
+        {
+            std::uint32_t queue;
+            std::uint64_t value;
+        };
+        
+        void Init(DeviceQueues const& device_queues);
+        
+        // Returns false for tickets known to be complete
+        bool ResolveTicket(Ticket ticket, TicketRecord& record);
+        
+        // Expect the queue mutex to be held
+        bool IsValueComplete(Queue& queue, std::uint64_t value);
+        void RetireCompleted(Queue& queue);
+        FencePtr AcquireFence(Queue& queue);
+        VkCommandBuffer GetBarrierCommandBuffer(Queue& queue);
+        void FlushQueue(Queue& queue);
+        
+        void WaitValue(Queue& queue, std::uint64_t value);
+        
         VkDevice device_;
-        std::uint32_t queue_family_index_;
+        
+        std::vector<std::unique_ptr<Queue>> queues_;
+        // Queues serving each type, types sharing a family share the queues
+        std::vector<std::uint32_t> type_queues_[kNumQueueTypes];
+        std::uint32_t type_family_index_[kNumQueueTypes];
+        std::uint32_t type_high_priority_queue_[kNumQueueTypes];
+        
+        // Ticket n is ticket_records_[n - first_record_ticket_]
+        std::mutex tickets_mutex_;
+        std::deque<TicketRecord> ticket_records_;
+        Ticket first_record_ticket_ = 1u;
+        // Per queue
+        std::vector<Ticket> last_tickets_;
+        
+        std::atomic<bool> batching_;
+        std::atomic<std::uint64_t> num_submits_;
+        std::atomic<std::uint64_t> num_queue_submits_;
+        std::atomic<std::uint64_t> queue_submit_time_ns_;
+        
+        bool use_timeline_semaphore_ = false;
+#ifdef VK_KHR_timeline_semaphore
+        PFN_vkGetSemaphoreCounterValueKHR get_semaphore_counter_value_ = nullptr;
+        PFN_vkWaitSemaphoresKHR wait_semaphores_ = nullptr;
+#endif
     };
 }
@@ -0,0 +1,193 @@
+#include "vk_frame_manager.h"
+#include "vk_descriptor_manager.h"
+#include <chrono>
+#include <stdexcept>
+
+namespace vkw
+{
+    FrameManager::FrameManager(VkDevice device,
+                               MemoryManager& memory_manager,
+                               ExecutionManager& execution_manager,
+                               QueueType queue_type,
+                               std::uint32_t num_frames,
+                               VkDeviceSize transient_size)
+    : device_(device)
+    , execution_manager_(execution_manager)
+    , command_pool_manager_(device, execution_manager.GetQueueFamilyIndex(queue_type), execution_manager, num_frames)
+    , queue_type_(queue_type)
+    , transient_size_(transient_size)
+    {
+        if (num_frames == 0u)
+        {
+            throw std::runtime_error("FrameManager: Number of frames can not be zero");
+        }
+        
+        frames_.resize(num_frames);
+        
+        VkDescriptorPoolSize pool_sizes[] =
+        {
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, DescriptorManager::kNumDescriptors },
+            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, DescriptorManager::kNumDescriptors },
+            { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, DescriptorManager::kNumDescriptors },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, DescriptorManager::kNumDescriptors },
+            { VK_DESCRIPTOR_TYPE_SAMPLER, DescriptorManager::kNumDescriptors },
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, DescriptorManager::kNumDescriptors }
+        };
+        
+        VkDescriptorPoolCreateInfo pool_create_info;
+        pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_create_info.pNext = nullptr;
+        pool_create_info.flags = 0;
+        pool_create_info.maxSets = DescriptorManager::kMaxSets;
+        pool_create_info.poolSizeCount = sizeof(pool_sizes) / sizeof(VkDescriptorPoolSize);
+        pool_create_info.pPoolSizes = pool_sizes;
+        
+        for (auto& frame : frames_)
+        {
+            // Sets are released all at once by vkResetDescriptorPool
+            VkDescriptorPool pool = nullptr;
+            auto res = vkCreateDescriptorPool(device, &pool_create_info, nullptr, &pool);
+            
+            if (res != VK_SUCCESS)
+            {
+                throw std::runtime_error("FrameManager: Cannot create descriptor pool");
+            }
+            
+            frame.descriptor_pool = VkScopedObject<VkDescriptorPool>(pool,
+                                                                     [device](VkDescriptorPool pool)
+                                                                     {
+                                                                         vkDestroyDescriptorPool(device, pool, nullptr);
+                                                                     });
+            
+            if (transient_size_ != 0u)
+            {
+                frame.transient_buffer = memory_manager.CreateBuffer(transient_size_,
+                                                                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                                                     VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                                                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                                                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+                
+                frame.transient_data = static_cast<std::uint8_t*>(memory_manager.MapBuffer(frame.transient_buffer));
+            }
+        }
+    }
+    
+    FrameManager::~FrameManager()
+    {
+        // Pools and transient buffers can not go away while in use
+        WaitIdle();
+    }
+    
+    std::uint32_t FrameManager::BeginFrame()
+    {
+        auto& frame = frames_[current_frame_];
+        
+        WaitFrame(frame);
+        
+        vkResetDescriptorPool(device_, frame.descriptor_pool, 0);
+        frame.transient_offset = 0u;
+        frame.retired_descriptor_sets.clear();
+        
+        if (destruction_queue_)
+        {
+            destruction_queue_->Collect();
+        }
+        
+        return current_frame_;
+    }
+    
+    Ticket FrameManager::EndFrame(VkCommandBuffer command_buffer, std::vector<Ticket> const& wait_tickets)
+    {
+        auto& frame = frames_[current_frame_];
+        
+        frame.ticket = execution_manager_.Submit(command_buffer, queue_type_, wait_tickets);
+        
+        // Moves the command pools on as well, waiting for the next slot
+        // there counts as waiting for it here
+        auto start = std::chrono::high_resolution_clock::now();
+        command_pool_manager_.EndFrame(frame.ticket);
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        wait_time_ += elapsed.count();
+        
+        current_frame_ = (current_frame_ + 1u) % frames_.size();
+        
+        return frame.ticket;
+    }
+    
+    TransientAllocation FrameManager::AllocateTransient(VkDeviceSize size, VkDeviceSize alignment)
+    {
+        auto& frame = frames_[current_frame_];
+        
+        alignment = alignment ? alignment : 1u;
+        auto offset = (frame.transient_offset + alignment - 1u) / alignment * alignment;
+        
+        if (offset + size > transient_size_)
+        {
+            throw std::runtime_error("FrameManager: Out of transient memory");
+        }
+        
+        frame.transient_offset = offset + size;
+        
+        return { frame.transient_buffer, offset, frame.transient_data + offset };
+    }
+    
+    VkScopedObject<VkDescriptorSet> FrameManager::AllocateDescriptorSet(VkDescriptorSetLayout layout)
+    {
+        VkDescriptorSetAllocateInfo allocate_info;
+        allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocate_info.pNext = nullptr;
+        allocate_info.descriptorPool = frames_[current_frame_].descriptor_pool;
+        allocate_info.descriptorSetCount = 1u;
+        allocate_info.pSetLayouts = &layout;
+        
+        VkDescriptorSet descriptor_set = nullptr;
+        auto res = vkAllocateDescriptorSets(device_, &allocate_info, &descriptor_set);
+        
+        if (res != VK_SUCCESS)
+        {
+            throw std::runtime_error("FrameManager: Cannot allocate descriptors");
+        }
+        
+        return VkScopedObject<VkDescriptorSet>(descriptor_set, [](VkDescriptorSet) {});
+    }
+    
+    void FrameManager::BindShader(Shader& shader)
+    {
+        // Work in flight may still use the old set, do not free it right away
+        auto old_descriptor_set = std::move(shader.descriptor_set);
+        shader.descriptor_set = AllocateDescriptorSet(shader.layout);
+        shader.SetDirty();
+        
+        if (destruction_queue_)
+        {
+            destruction_queue_->Release(std::move(old_descriptor_set));
+        }
+        else
+        {
+            frames_[current_frame_].retired_descriptor_sets.push_back(std::move(old_descriptor_set));
+        }
+    }
+    
+    void FrameManager::WaitIdle()
+    {
+        for (auto& frame : frames_)
+        {
+            execution_manager_.Wait(frame.ticket);
+        }
+    }
+    
+    void FrameManager::WaitFrame(Frame& frame)
+    {
+        if (execution_manager_.IsComplete(frame.ticket))
+        {
+            return;
+        }
+        
+        auto start = std::chrono::high_resolution_clock::now();
+        execution_manager_.Wait(frame.ticket);
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        wait_time_ += elapsed.count();
+    }
+}
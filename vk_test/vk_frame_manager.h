@@ -0,0 +1,134 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_scoped_object.h"
+#include "vk_execution_manager.h"
+#include "vk_command_pool_manager.h"
+#include "vk_memory_manager.h"
+#include "vk_shader_manager.h"
+#include "vk_destruction_queue.h"
+#include <vector>
+
+namespace vkw
+{
+    // Host visible, coherent range of a frame's transient buffer
+    struct TransientAllocation
+    {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        void* data;
+    };
+    
+    // Frames in flight. Each slot has its own command pools, descriptor pool,
+    // transient ring buffer and ticket. The CPU records the next frame while
+    // the GPU runs the previous ones and only blocks in BeginFrame when the
+    // slot it moves to is still in use, so with enough slots a frame costs the
+    // larger of CPU and GPU time instead of their sum.
+    //
+    // Everything allocated in a frame lives until its slot comes around
+    // again, meant to be driven from a single thread (command buffers can be
+    // recorded from several, see CommandPoolManager).
+    class FrameManager
+    {
+    public:
+        static std::uint32_t constexpr kDefaultNumFrames = CommandPoolManager::kDefaultNumFrames;
+        static VkDeviceSize constexpr kDefaultTransientSize = 4u * 1024u * 1024u;
+        // Covers minStorageBufferOffsetAlignment and friends on every device
+        static VkDeviceSize constexpr kTransientAlignment = 256u;
+        
+        FrameManager(VkDevice device,
+                     MemoryManager& memory_manager,
+                     ExecutionManager& execution_manager,
+                     QueueType queue_type = QueueType::kGraphics,
+                     std::uint32_t num_frames = kDefaultNumFrames,
+                     VkDeviceSize transient_size = kDefaultTransientSize);
+        
+        ~FrameManager();
+        
+        FrameManager(FrameManager const&) = delete;
+        FrameManager& operator=(FrameManager const&) = delete;
+        
+        // Waits for the work the slot ran last time around and recycles its
+        // descriptor sets and transient memory. Whatever that work wrote can
+        // be read back at this point. Returns the slot index.
+        std::uint32_t BeginFrame();
+        
+        // Submit the frame's work, its command buffer should come from the
+        // CommandPoolManager. Returns the ticket covering the frame.
+        Ticket EndFrame(VkCommandBuffer command_buffer,
+                        std::vector<Ticket> const& wait_tickets = std::vector<Ticket>());
+        
+        // For a CommandBufferBuilder recording the frames
+        CommandPoolManager& GetCommandPoolManager() { return command_pool_manager_; }
+        
+        std::uint32_t GetFrameIndex() const { return current_frame_; }
+        std::uint32_t GetNumFrames() const { return (std::uint32_t)frames_.size(); }
+        
+        // Sub-allocate from the current frame's ring
+        TransientAllocation AllocateTransient(VkDeviceSize size, VkDeviceSize alignment = kTransientAlignment);
+        
+        // Descriptor set from the current frame's pool, the handle does not own it
+        VkScopedObject<VkDescriptorSet> AllocateDescriptorSet(VkDescriptorSetLayout layout);
+        
+        // Give the shader a descriptor set of the current frame so updating its
+        // arguments does not touch a set in use by earlier frames. The args are
+        // written again on the next dispatch. The set the shader had is handed
+        // to the DestructionQueue, or without one kept until this slot comes
+        // around again, which only covers work on the frame queue.
+        void BindShader(Shader& shader);
+        
+        void WaitIdle();
+        
+        // Collected by every BeginFrame
+        void SetDestructionQueue(DestructionQueue* destruction_queue) { destruction_queue_ = destruction_queue; }
+        
+        // CPU seconds spent blocked on busy slots
+        double GetWaitTime() const { return wait_time_; }
+        void ResetWaitTime() { wait_time_ = 0.0; }
+        
+    private:
+        struct Frame
+        {
+            Ticket ticket = 0u;
+            VkScopedObject<VkDescriptorPool> descriptor_pool;
+            VkScopedObject<VkBuffer> transient_buffer;
+            std::uint8_t* transient_data = nullptr;
+            VkDeviceSize transient_offset = 0u;
+            // Sets replaced by BindShader
+            std::vector<VkScopedObject<VkDescriptorSet>> retired_descriptor_sets;
+        };
+        
+        void WaitFrame(Frame& frame);
+        
+        VkDevice device_;
+        ExecutionManager& execution_manager_;
+        CommandPoolManager command_pool_manager_;
+        QueueType queue_type_;
+        VkDeviceSize transient_size_;
+        
+        std::vector<Frame> frames_;
+        std::uint32_t current_frame_ = 0u;
+        double wait_time_ = 0.0;
+        DestructionQueue* destruction_queue_ = nullptr;
+    };
+}
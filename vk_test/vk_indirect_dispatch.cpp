@@ -0,0 +1,64 @@
+#include "vk_indirect_dispatch.h"
+#include <stdexcept>
+
+namespace vkw
+{
+    GroupCountGenerator::GroupCountGenerator(ShaderManager& shader_manager,
+                                             PipelineManager& pipeline_manager,
+                                             std::string const& shader_file)
+    : shader_manager_(shader_manager)
+    , pipeline_manager_(pipeline_manager)
+    , shader_file_(shader_file)
+    {
+    }
+    
+    void GroupCountGenerator::Record(CommandBufferBuilder& builder,
+                                     ComputePipeline const& pipeline,
+                                     VkBuffer count_buffer,
+                                     VkDeviceSize count_offset,
+                                     VkBuffer args_buffer,
+                                     VkDeviceSize args_offset,
+                                     std::uint32_t max_group_count)
+    {
+        if ((count_offset % 4) != 0 || (args_offset % 4) != 0)
+        {
+            throw std::runtime_error("GroupCountGenerator: Offsets should be multiples of 4");
+        }
+        
+        auto& shader = shaders_[std::make_pair(count_buffer, args_buffer)];
+        
+        if (!shader)
+        {
+            shader.reset(new Shader(shader_manager_.CreateShader(VK_SHADER_STAGE_COMPUTE_BIT, shader_file_)));
+            shader->SetArg(0u, count_buffer);
+            shader->SetArg(1u, args_buffer);
+        }
+        
+        if (!pipeline_)
+        {
+            pipeline_.reset(new ComputePipeline(pipeline_manager_.CreateComputePipeline(*shader, 1u, 1u, 1u)));
+        }
+        
+        // The count is linear, a 2D or 3D group still covers all of its invocations
+        auto group_size = pipeline.group_size[0] * pipeline.group_size[1] * pipeline.group_size[2];
+        
+        shader->SetPushConstant("group_size", group_size);
+        shader->SetPushConstant("count_index", (std::uint32_t)(count_offset / 4));
+        shader->SetPushConstant("args_index", (std::uint32_t)(args_offset / 4));
+        shader->SetPushConstant("max_group_count", max_group_count);
+        
+        builder.Dispatch(*pipeline_, *shader, 1u, 1u, 1u);
+        
+        // The builder takes care of it otherwise
+        if (!builder.GetStateTracker())
+        {
+            builder.Barrier(args_buffer,
+                            VK_ACCESS_SHADER_WRITE_BIT,
+                            VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                            args_offset,
+                            sizeof(VkDispatchIndirectCommand));
+        }
+    }
+}
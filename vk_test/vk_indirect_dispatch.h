@@ -0,0 +1,69 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_scoped_object.h"
+#include "vk_shader_manager.h"
+#include "vk_pipeline_manager.h"
+#include "vk_command_buffer_builder.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace vkw
+{
+    // Records a one thread kernel computing the group counts of a follow-up
+    // DispatchIndirect from an element count left in a buffer by an earlier
+    // kernel, so a stage sized by the previous one needs no readback.
+    class GroupCountGenerator
+    {
+    public:
+        GroupCountGenerator(ShaderManager& shader_manager,
+                            PipelineManager& pipeline_manager,
+                            std::string const& shader_file = "group_count.comp.spv");
+        
+        // Writes a VkDispatchIndirectCommand for pipeline's group size to
+        // args_buffer at args_offset, from the uint32 count at count_offset.
+        // Elements count against all the invocations of a group and groups go
+        // along x, clamped to max_group_count (maxComputeWorkGroupCount[0]).
+        // Without a state tracker on the builder the earlier write to the count
+        // has to be synchronized by the caller.
+        void Record(CommandBufferBuilder& builder,
+                    ComputePipeline const& pipeline,
+                    VkBuffer count_buffer,
+                    VkDeviceSize count_offset,
+                    VkBuffer args_buffer,
+                    VkDeviceSize args_offset,
+                    std::uint32_t max_group_count = CommandBufferBuilder::kMinMaxGroupCount);
+        
+    private:
+        ShaderManager& shader_manager_;
+        PipelineManager& pipeline_manager_;
+        std::string shader_file_;
+        
+        // Group size and offsets are push constants, one pipeline serves all
+        std::unique_ptr<ComputePipeline> pipeline_;
+        // Descriptor sets are written when the command buffer is recorded, one per buffer pair
+        std::map<std::pair<VkBuffer, VkBuffer>, std::unique_ptr<Shader>> shaders_;
+    };
+}
@@ -0,0 +1,365 @@
+#include "vk_job_scheduler.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace vkw
+{
+    JobScheduler::JobScheduler(ExecutionManager& execution_manager,
+                               QueueType queue_type,
+                               std::uint32_t max_in_flight)
+    : execution_manager_(execution_manager)
+    , queue_type_(queue_type)
+    , max_in_flight_(max_in_flight)
+    {
+        if (max_in_flight_ == 0u)
+        {
+            throw std::runtime_error("JobScheduler: Max in flight can not be zero");
+        }
+        
+        auto high_priority_queue = execution_manager_.GetHighPriorityQueue(queue_type_);
+        queue_index_[kNormalSlot] = 0u;
+        queue_index_[kHighPrioritySlot] = high_priority_queue == kNoQueue ? 0u : high_priority_queue;
+        
+        dispatcher_ = std::thread([this]() { DispatchLoop(); });
+    }
+    
+    JobScheduler::~JobScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        
+        dispatch_condition_.notify_one();
+        dispatcher_.join();
+        
+        WaitIdle();
+    }
+    
+    JobScheduler::TenantId JobScheduler::AddTenant(std::string const& name,
+                                                   std::uint32_t weight,
+                                                   JobPriority priority)
+    {
+        if (weight == 0u)
+        {
+            throw std::runtime_error("JobScheduler: Tenant weight can not be zero");
+        }
+        
+        std::unique_ptr<Tenant> tenant(new Tenant());
+        tenant->name = name;
+        tenant->weight = weight;
+        tenant->priority = priority;
+        tenant->stats = TenantStats();
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        auto id = (TenantId)tenants_.size();
+        tenants_.push_back(std::move(tenant));
+        classes_[(std::uint32_t)priority].tenants.push_back(id);
+        
+        return id;
+    }
+    
+    std::string const& JobScheduler::GetTenantName(TenantId tenant) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        if (tenant >= tenants_.size())
+        {
+            throw std::runtime_error("JobScheduler: Invalid tenant");
+        }
+        
+        return tenants_[tenant]->name;
+    }
+    
+    JobScheduler::JobId JobScheduler::Submit(TenantId tenant, VkCommandBuffer command_buffer, std::uint64_t cost)
+    {
+        JobId id = 0u;
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            if (tenant >= tenants_.size())
+            {
+                throw std::runtime_error("JobScheduler: Invalid tenant");
+            }
+            
+            auto& owner = *tenants_[tenant];
+            
+            id = first_job_ + job_tickets_.size();
+            job_tickets_.push_back(0u);
+            
+            owner.jobs.push_back({ id, tenant, command_buffer, cost, Clock::now() });
+            ++classes_[(std::uint32_t)owner.priority].num_queued;
+            ++num_unsubmitted_;
+            
+            quantum_ = std::max(quantum_, cost);
+        }
+        
+        dispatch_condition_.notify_one();
+        
+        return id;
+    }
+    
+    bool JobScheduler::IsComplete(JobId job)
+    {
+        Ticket ticket = 0u;
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            if (!ResolveJob(job, ticket))
+            {
+                return true;
+            }
+            
+            if (ticket == 0u)
+            {
+                return false;
+            }
+        }
+        
+        return execution_manager_.IsComplete(ticket);
+    }
+    
+    void JobScheduler::Wait(JobId job)
+    {
+        Ticket ticket = 0u;
+        
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            
+            submitted_condition_.wait(lock, [this, job, &ticket]()
+                                      {
+                                          return !ResolveJob(job, ticket) || ticket != 0u;
+                                      });
+        }
+        
+        if (ticket != 0u)
+        {
+            execution_manager_.Wait(ticket);
+        }
+    }
+    
+    void JobScheduler::WaitIdle()
+    {
+        std::vector<Ticket> tickets;
+        
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            
+            submitted_condition_.wait(lock, [this]() { return num_unsubmitted_ == 0u; });
+            
+            tickets.assign(job_tickets_.cbegin(), job_tickets_.cend());
+        }
+        
+        for (auto ticket : tickets)
+        {
+            execution_manager_.Wait(ticket);
+        }
+    }
+    
+    TenantStats JobScheduler::GetTenantStats(TenantId tenant) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        if (tenant >= tenants_.size())
+        {
+            throw std::runtime_error("JobScheduler: Invalid tenant");
+        }
+        
+        auto stats = tenants_[tenant]->stats;
+        stats.num_queued = tenants_[tenant]->jobs.size();
+        
+        return stats;
+    }
+    
+    void JobScheduler::ResetStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        for (auto& tenant : tenants_)
+        {
+            tenant->stats = TenantStats();
+        }
+    }
+    
+    void JobScheduler::DispatchLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        
+        for (;;)
+        {
+            dispatch_condition_.wait(lock, [this]()
+                                     {
+                                         return quit_ || num_unsubmitted_ > 0u;
+                                     });
+            
+            // Quit once everything queued went out
+            if (num_unsubmitted_ == 0u)
+            {
+                break;
+            }
+            
+            RetireCompleted();
+            
+            // Highest priority class with work and room on its queue
+            Job job;
+            auto slot = kNormalSlot;
+            auto blocked_slot = kNumSlots;
+            auto found = false;
+            
+            for (auto priority = 0u; priority < kNumJobPriorities && !found; ++priority)
+            {
+                if (classes_[priority].num_queued == 0u)
+                {
+                    continue;
+                }
+                
+                slot = GetSlot(priority);
+                
+                if (in_flight_[slot].size() >= max_in_flight_)
+                {
+                    blocked_slot = blocked_slot == kNumSlots ? slot : blocked_slot;
+                    continue;
+                }
+                
+                found = PickJob(classes_[priority], job);
+            }
+            
+            // Every class with work is waiting for room on its queue
+            if (!found)
+            {
+                if (queue_index_[kNormalSlot] == queue_index_[kHighPrioritySlot])
+                {
+                    // Single queue, nothing can go out before its oldest job is done
+                    auto ticket = in_flight_[blocked_slot].front();
+                    lock.unlock();
+                    execution_manager_.Wait(ticket);
+                    lock.lock();
+                }
+                else
+                {
+                    // The other queue may free up or get work first, poll
+                    dispatch_condition_.wait_for(lock, std::chrono::microseconds(50));
+                }
+                
+                continue;
+            }
+            
+            lock.unlock();
+            auto ticket = execution_manager_.Submit(job.command_buffer,
+                                                    queue_type_,
+                                                    std::vector<Ticket>(),
+                                                    queue_index_[slot]);
+            std::chrono::duration<double> delay = Clock::now() - job.submit_time;
+            lock.lock();
+            
+            in_flight_[slot].push_back(ticket);
+            job_tickets_[job.id - first_job_] = ticket;
+            --num_unsubmitted_;
+            
+            auto& stats = tenants_[job.tenant]->stats;
+            ++stats.num_jobs;
+            stats.total_delay += delay.count();
+            stats.max_delay = std::max(stats.max_delay, delay.count());
+            
+            auto us = (std::uint64_t)(delay.count() * 1e6);
+            auto bucket = 0u;
+            while (us != 0u && bucket < kNumDelayBuckets - 1u)
+            {
+                us >>= 1;
+                ++bucket;
+            }
+            
+            ++stats.delay_histogram[bucket];
+            
+            submitted_condition_.notify_all();
+        }
+    }
+    
+    bool JobScheduler::PickJob(PriorityClass& priority_class, Job& job)
+    {
+        if (priority_class.num_queued == 0u)
+        {
+            return false;
+        }
+        
+        // The quantum covers any job, so a credited tenant with work always
+        // sends at least one and the loop ends within a round
+        for (;;)
+        {
+            auto& tenant = *tenants_[priority_class.tenants[priority_class.cursor]];
+            
+            if (!priority_class.credited)
+            {
+                tenant.deficit += quantum_ * tenant.weight;
+                priority_class.credited = true;
+            }
+            
+            if (tenant.jobs.empty())
+            {
+                // Idle tenants do not bank credit
+                tenant.deficit = 0u;
+            }
+            else if (tenant.deficit >= tenant.jobs.front().cost)
+            {
+                job = tenant.jobs.front();
+                tenant.jobs.pop_front();
+                tenant.deficit -= job.cost;
+                --priority_class.num_queued;
+                return true;
+            }
+            
+            priority_class.cursor = (priority_class.cursor + 1u) % priority_class.tenants.size();
+            priority_class.credited = false;
+        }
+    }
+    
+    JobScheduler::Slot JobScheduler::GetSlot(std::uint32_t priority) const
+    {
+        if (priority == (std::uint32_t)JobPriority::kHigh &&
+            queue_index_[kHighPrioritySlot] != queue_index_[kNormalSlot])
+        {
+            return kHighPrioritySlot;
+        }
+        
+        return kNormalSlot;
+    }
+    
+    void JobScheduler::RetireCompleted()
+    {
+        for (auto& in_flight : in_flight_)
+        {
+            while (!in_flight.empty() && execution_manager_.IsComplete(in_flight.front()))
+            {
+                in_flight.pop_front();
+            }
+        }
+        
+        // Jobs below first_job_ are known complete
+        while (!job_tickets_.empty() &&
+               job_tickets_.front() != 0u &&
+               execution_manager_.IsComplete(job_tickets_.front()))
+        {
+            job_tickets_.pop_front();
+            ++first_job_;
+        }
+    }
+    
+    bool JobScheduler::ResolveJob(JobId job, Ticket& ticket)
+    {
+        if (job < first_job_)
+        {
+            return false;
+        }
+        
+        if (job - first_job_ >= job_tickets_.size())
+        {
+            throw std::runtime_error("JobScheduler: Invalid job");
+        }
+        
+        ticket = job_tickets_[job - first_job_];
+        return true;
+    }
+}
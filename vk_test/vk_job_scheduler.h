@@ -0,0 +1,180 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_execution_manager.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vkw
+{
+    // Strict order between classes, weighted sharing within one
+    enum class JobPriority
+    {
+        kHigh = 0,
+        kNormal,
+        kLow
+    };
+    
+    static std::uint32_t constexpr kNumJobPriorities = 3u;
+    
+    // Bucket 0 counts delays under 1 us, bucket i delays in [2^(i-1), 2^i) us,
+    // the last one everything above
+    static std::uint32_t constexpr kNumDelayBuckets = 32u;
+    
+    struct TenantStats
+    {
+        std::uint64_t num_jobs;     // handed to the ExecutionManager
+        std::uint64_t num_queued;   // still waiting in the tenant queue
+        double total_delay;         // seconds between Submit and queue submission
+        double max_delay;
+        std::uint64_t delay_histogram[kNumDelayBuckets];
+    };
+    
+    // Sits in front of an ExecutionManager and shares a queue type between
+    // tenants. Command buffers wait in per tenant queues and a dispatcher
+    // thread hands them over one at a time, keeping at most max_in_flight of
+    // them on each queue so a newly arrived job is only ever behind that many
+    // command buffers. The next job comes from the highest priority class
+    // with work, tenants of a class are served by deficit round robin in
+    // proportion to their weights and the cost of their jobs.
+    //
+    // High priority jobs go to the high priority queue of the type when the
+    // device has one, to the same queue as the others otherwise.
+    class JobScheduler
+    {
+    public:
+        using TenantId = std::uint32_t;
+        // Job 0 is always complete
+        using JobId = std::uint64_t;
+        
+        JobScheduler(ExecutionManager& execution_manager,
+                     QueueType queue_type = QueueType::kCompute,
+                     std::uint32_t max_in_flight = 2u);
+        
+        // Submits what is still queued and waits for it
+        ~JobScheduler();
+        
+        JobScheduler(JobScheduler const&) = delete;
+        JobScheduler& operator=(JobScheduler const&) = delete;
+        
+        TenantId AddTenant(std::string const& name,
+                           std::uint32_t weight = 1u,
+                           JobPriority priority = JobPriority::kNormal);
+        
+        std::string const& GetTenantName(TenantId tenant) const;
+        
+        // Command buffer has to stay alive until the job is complete. Cost is
+        // in any unit consistent across tenants (estimated GPU time, work
+        // items), weights split the sum of it.
+        JobId Submit(TenantId tenant, VkCommandBuffer command_buffer, std::uint64_t cost = 1u);
+        
+        // Safe to call from any thread
+        bool IsComplete(JobId job);
+        void Wait(JobId job);
+        void WaitIdle();
+        
+        TenantStats GetTenantStats(TenantId tenant) const;
+        void ResetStats();
+        
+    private:
+        using Clock = std::chrono::high_resolution_clock;
+        
+        struct Job
+        {
+            JobId id;
+            TenantId tenant;
+            VkCommandBuffer command_buffer;
+            std::uint64_t cost;
+            Clock::time_point submit_time;
+        };
+        
+        struct Tenant
+        {
+            std::string name;
+            std::uint32_t weight;
+            JobPriority priority;
+            std::deque<Job> jobs;
+            std::uint64_t deficit = 0u;
+            TenantStats stats;
+        };
+        
+        // Round robin state of a priority class
+        struct PriorityClass
+        {
+            std::vector<TenantId> tenants;
+            std::size_t cursor = 0u;
+            // Tenant under the cursor got its quantum this round
+            bool credited = false;
+            std::size_t num_queued = 0u;
+        };
+        
+        // Normal queue and high priority queue
+        enum Slot
+        {
+            kNormalSlot = 0,
+            kHighPrioritySlot,
+            kNumSlots
+        };
+        
+        void DispatchLoop();
+        
+        // Expect the mutex to be held
+        bool PickJob(PriorityClass& priority_class, Job& job);
+        Slot GetSlot(std::uint32_t priority) const;
+        void RetireCompleted();
+        bool ResolveJob(JobId job, Ticket& ticket);
+        
+        ExecutionManager& execution_manager_;
+        QueueType queue_type_;
+        std::uint32_t max_in_flight_;
+        std::uint32_t queue_index_[kNumSlots];
+        
+        // Guards everything below
+        mutable std::mutex mutex_;
+        std::condition_variable dispatch_condition_;
+        std::condition_variable submitted_condition_;
+        
+        std::vector<std::unique_ptr<Tenant>> tenants_;
+        PriorityClass classes_[kNumJobPriorities];
+        // DRR quantum, the largest job cost seen so every visit can afford a job
+        std::uint64_t quantum_ = 1u;
+        
+        // Tickets of submitted jobs per slot, oldest first
+        std::deque<Ticket> in_flight_[kNumSlots];
+        
+        // Ticket of job n is job_tickets_[n - first_job_], 0 while queued
+        std::deque<Ticket> job_tickets_;
+        JobId first_job_ = 1u;
+        // Queued plus being handed to the ExecutionManager
+        std::size_t num_unsubmitted_ = 0u;
+        
+        bool quit_ = false;
+        std::thread dispatcher_;
+    };
+}
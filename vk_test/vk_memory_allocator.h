@@ -84,6 +84,22 @@ namespace vkw
         // Deallocate the block (the buffer is unbound and destroyed).
         void deallocate(StorageBlock const& block);
         
+        // Check if there is a memory type having all the specified flags
+        bool IsMemoryTypeSupported(VkMemoryPropertyFlags type)
+        {
+            return FindMemoryTypeIndex(type) != -1;
+        }
+        
+        // Host pointer to the block. Host visible memory is mapped once
+        // on first use and stays mapped until the allocator is destroyed.
+        void* map(StorageBlock const& block);
+        
+        // Property flags of the memory type the block has been allocated from
+        VkMemoryPropertyFlags GetMemoryPropertyFlags(int memory_type_index) const
+        {
+            return memory_type_index < 0 ? 0 : memory_props_.memoryTypes[memory_type_index].propertyFlags;
+        }
+        
     private:
         // Find memory type index corresponding to specified flags
         int FindMemoryTypeIndex(VkMemoryPropertyFlags type)
@@ -102,7 +118,7 @@ namespace vkw
             return index;
         }
         
-        // Release everything
+        // Release everything (freeing memory implicitly unmaps it)
         void ReleaseMemory()
         {
             for (auto& h : alloc_headers_)
@@ -129,8 +145,30 @@ namespace vkw
         VkPhysicalDeviceMemoryProperties memory_props_;
         // Headers
         std::unordered_map<int, AllocationHeader> alloc_headers_;
+        // Persistently mapped host visible memories
+        std::unordered_map<VkDeviceMemory, void*> mapped_memories_;
     };
     
+    inline void* MemoryAllocator::map(StorageBlock const& block)
+    {
+        auto iter = mapped_memories_.find(block.memory);
+        
+        if (iter == mapped_memories_.cend())
+        {
+            void* mapped_ptr = nullptr;
+            auto res = vkMapMemory(device_, block.memory, 0u, VK_WHOLE_SIZE, 0, &mapped_ptr);
+            
+            if (res != VK_SUCCESS)
+            {
+                throw std::runtime_error("VkMemoryAllocator: Cannot map host visible memory");
+            }
+            
+            iter = mapped_memories_.emplace(block.memory, mapped_ptr).first;
+        }
+        
+        return static_cast<char*>(iter->second) + block.offset;
+    }
+    
     inline
     MemoryAllocator::StorageBlock MemoryAllocator::allocate(VkMemoryPropertyFlags type,
                                                               //VkBufferUsageFlags usage,
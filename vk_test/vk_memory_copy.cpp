@@ -0,0 +1,175 @@
+#include "vk_memory_copy.h"
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace vkw
+{
+    namespace
+    {
+        // Fixed size copies compile to plain vector loads and stores
+        template <std::size_t kSize>
+        void GatherField(char* dst, char const* src, std::size_t stride, std::size_t count)
+        {
+            for (auto i = 0u; i < count; ++i)
+            {
+                std::memcpy(dst + i * kSize, src + i * stride, kSize);
+            }
+        }
+        
+        void GatherField(char* dst, char const* src, std::size_t size, std::size_t stride, std::size_t count)
+        {
+            switch (size)
+            {
+                case 1u: GatherField<1u>(dst, src, stride, count); break;
+                case 2u: GatherField<2u>(dst, src, stride, count); break;
+                case 4u: GatherField<4u>(dst, src, stride, count); break;
+                case 8u: GatherField<8u>(dst, src, stride, count); break;
+                case 12u: GatherField<12u>(dst, src, stride, count); break;
+                case 16u: GatherField<16u>(dst, src, stride, count); break;
+                default:
+                    for (auto i = 0u; i < count; ++i)
+                    {
+                        std::memcpy(dst + i * size, src + i * stride, size);
+                    }
+                    break;
+            }
+        }
+    }
+    
+    void StreamingCopy(void* dst, void const* src, std::size_t size)
+    {
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#if defined(__AVX__)
+        using Vector = __m256i;
+#else
+        using Vector = __m128i;
+#endif
+        static std::size_t constexpr kVectorSize = sizeof(Vector);
+        static std::size_t constexpr kBlockSize = 4u * kVectorSize;
+        
+        auto d = static_cast<char*>(dst);
+        auto s = static_cast<char const*>(src);
+        
+        // Streaming stores require aligned destination, copy the head normally
+        auto misalignment = reinterpret_cast<std::uintptr_t>(d) & (kVectorSize - 1);
+        auto head = std::min(size, misalignment ? kVectorSize - misalignment : 0u);
+        std::memcpy(d, s, head);
+        d += head;
+        s += head;
+        size -= head;
+        
+        // Main loop, four vectors in flight to keep the write combining buffers busy
+        auto num_blocks = size / kBlockSize;
+        for (auto i = 0u; i < num_blocks; ++i)
+        {
+#if defined(__AVX__)
+            auto v0 = _mm256_loadu_si256(reinterpret_cast<Vector const*>(s));
+            auto v1 = _mm256_loadu_si256(reinterpret_cast<Vector const*>(s) + 1);
+            auto v2 = _mm256_loadu_si256(reinterpret_cast<Vector const*>(s) + 2);
+            auto v3 = _mm256_loadu_si256(reinterpret_cast<Vector const*>(s) + 3);
+            _mm256_stream_si256(reinterpret_cast<Vector*>(d), v0);
+            _mm256_stream_si256(reinterpret_cast<Vector*>(d) + 1, v1);
+            _mm256_stream_si256(reinterpret_cast<Vector*>(d) + 2, v2);
+            _mm256_stream_si256(reinterpret_cast<Vector*>(d) + 3, v3);
+#else
+            auto v0 = _mm_loadu_si128(reinterpret_cast<Vector const*>(s));
+            auto v1 = _mm_loadu_si128(reinterpret_cast<Vector const*>(s) + 1);
+            auto v2 = _mm_loadu_si128(reinterpret_cast<Vector const*>(s) + 2);
+            auto v3 = _mm_loadu_si128(reinterpret_cast<Vector const*>(s) + 3);
+            _mm_stream_si128(reinterpret_cast<Vector*>(d), v0);
+            _mm_stream_si128(reinterpret_cast<Vector*>(d) + 1, v1);
+            _mm_stream_si128(reinterpret_cast<Vector*>(d) + 2, v2);
+            _mm_stream_si128(reinterpret_cast<Vector*>(d) + 3, v3);
+#endif
+            d += kBlockSize;
+            s += kBlockSize;
+        }
+        
+        // Make streaming stores globally visible before anybody unmaps or flushes
+        _mm_sfence();
+        
+        std::memcpy(d, s, size - num_blocks * kBlockSize);
+#else
+        std::memcpy(dst, src, size);
+#endif
+    }
+    
+    void ParallelCopy(ThreadPool& pool,
+                      void* dst,
+                      void const* src,
+                      std::size_t size,
+                      std::size_t threshold)
+    {
+        static std::size_t constexpr kCacheLineSize = 64u;
+        
+        if (size < threshold || pool.GetNumThreads() < 2u)
+        {
+            std::memcpy(dst, src, size);
+            return;
+        }
+        
+        auto num_chunks = pool.GetNumThreads();
+        auto chunk_size = (size + num_chunks - 1) / num_chunks;
+        chunk_size = (chunk_size + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
+        
+        pool.ParallelFor(num_chunks,
+                         [dst, src, size, chunk_size](std::size_t i)
+                         {
+                             auto offset = std::min(size, i * chunk_size);
+                             auto count = std::min(size - offset, chunk_size);
+                             
+                             StreamingCopy(static_cast<char*>(dst) + offset,
+                                           static_cast<char const*>(src) + offset,
+                                           count);
+                         });
+    }
+    
+    void GatherFields(ThreadPool& pool,
+                      void const* records,
+                      std::size_t stride,
+                      std::size_t count,
+                      std::vector<FieldCopy> const& fields,
+                      std::size_t threshold)
+    {
+        // Records per chunk, small enough for the chunk to stay in cache
+        // while every field of it is gathered
+        static std::size_t constexpr kChunkSize = 4096u;
+        
+        auto num_chunks = (count + kChunkSize - 1) / kChunkSize;
+        
+        auto gather_chunk = [records, stride, count, &fields](std::size_t chunk)
+        {
+            auto first = chunk * kChunkSize;
+            auto num_records = std::min(count - first, kChunkSize);
+            auto src = static_cast<char const*>(records) + first * stride;
+            
+            for (auto& field : fields)
+            {
+                GatherField(static_cast<char*>(field.dst) + first * field.size,
+                            src + field.offset,
+                            field.size,
+                            stride,
+                            num_records);
+            }
+        };
+        
+        if (count * stride < threshold || pool.GetNumThreads() < 2u)
+        {
+            for (auto i = 0u; i < num_chunks; ++i)
+            {
+                gather_chunk(i);
+            }
+        }
+        else
+        {
+            pool.ParallelFor(num_chunks, gather_chunk);
+        }
+    }
+}
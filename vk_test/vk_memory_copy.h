@@ -0,0 +1,60 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "vk_thread_pool.h"
+
+namespace vkw
+{
+    // Copies below this size are not worth waking up worker threads for
+    static std::size_t constexpr kParallelCopyThreshold = 4u * 1024u * 1024u;
+    
+    // Copy using non-temporal (streaming) stores where the CPU supports them.
+    // Bypasses the cache which is what write-combined mapped memory wants.
+    void StreamingCopy(void* dst, void const* src, std::size_t size);
+    
+    // Split the copy into cache line aligned chunks and stream them from
+    // all pool threads. Falls back to std::memcpy below the threshold.
+    void ParallelCopy(ThreadPool& pool,
+                      void* dst,
+                      void const* src,
+                      std::size_t size,
+                      std::size_t threshold = kParallelCopyThreshold);
+    
+    // One field of an array-of-structs record, gathered into a packed array at dst
+    struct FieldCopy
+    {
+        std::size_t offset;
+        std::size_t size;
+        void* dst;
+    };
+    
+    // AoS to SoA transpose: field i of record r goes to fields[i].dst + r * fields[i].size.
+    // Record ranges are split between pool threads above the threshold.
+    void GatherFields(ThreadPool& pool,
+                      void const* records,
+                      std::size_t stride,
+                      std::size_t count,
+                      std::vector<FieldCopy> const& fields,
+                      std::size_t threshold = kParallelCopyThreshold);
+}
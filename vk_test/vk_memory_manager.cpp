@@ -1,4 +1,8 @@
 #include "vk_memory_manager.h"
+#include "vk_memory_copy.h"
+#include "vk_utils.h"
+#include <algorithm>
+#include <limits>
 
 namespace vkw
 {
@@ -7,21 +11,30 @@ namespace vkw
                                                  VkDeviceSize size,
                                                  void const* data)
     {
-        void* mapped_ptr = nullptr;
-        auto res = vkMapMemory(device,
-                               storage_block.memory,
-                               storage_block.offset,
-                               storage_block.size,
-                               0,
-                               &mapped_ptr);
+        CopyRegionsToHostVisibleBlock(device, storage_block, { VkBufferCopy{ 0u, 0u, size } }, data);
+    }
+    
+    void MemoryManager::CopyRegionsToHostVisibleBlock(VkDevice device,
+                                                        MemoryAllocator::StorageBlock const& storage_block,
+                                                        std::vector<VkBufferCopy> const& regions,
+                                                        void const* data)
+    {
+        auto mapped_ptr = allocator_.map(storage_block);
         
-        if (res != VK_SUCCESS)
+        for (auto& region : regions)
         {
-            throw std::runtime_error("VkMemoryManager: Cannot map host visible buffer");
+            ParallelCopy(*copy_pool_,
+                         (char*)mapped_ptr + region.dstOffset,
+                         (char const*)data + region.srcOffset,
+                         region.size);
         }
         
-        std::copy((char const*)data, (char const*)data + size, (char*)mapped_ptr);
-        
+        FlushHostVisibleBlock(device, storage_block);
+    }
+    
+    void MemoryManager::FlushHostVisibleBlock(VkDevice device,
+                                                MemoryAllocator::StorageBlock const& storage_block)
+    {
         VkMappedMemoryRange mapped_range;
         mapped_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
         mapped_range.pNext = nullptr;
@@ -30,26 +43,15 @@ namespace vkw
         mapped_range.size = storage_block.size;
         
         vkFlushMappedMemoryRanges(device, 1u, &mapped_range);
-        vkUnmapMemory(device, storage_block.memory);
     }
     
     void MemoryManager::CopyFromHostVisibleBlock(VkDevice device,
                                                    MemoryAllocator::StorageBlock const& storage_block,
+                                                   VkDeviceSize offset,
                                                    VkDeviceSize size,
                                                    void* data)
     {
-        void* mapped_ptr = nullptr;
-        auto res = vkMapMemory(device,
-                               storage_block.memory,
-                               storage_block.offset,
-                               storage_block.size,
-                               0,
-                               &mapped_ptr);
-        
-        if (res != VK_SUCCESS)
-        {
-            throw std::runtime_error("VkMemoryManager: Cannot map host visible buffer");
-        }
+        auto mapped_ptr = allocator_.map(storage_block);
         
         VkMappedMemoryRange mapped_range;
         mapped_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
@@ -60,9 +62,7 @@ namespace vkw
         
         vkInvalidateMappedMemoryRanges(device, 1u, &mapped_range);
         
-        std::copy((char*)mapped_ptr, (char*)mapped_ptr + size, (char*)data);
-        
-        vkUnmapMemory(device, storage_block.memory);
+        std::copy((char*)mapped_ptr + offset, (char*)mapped_ptr + offset + size, (char*)data);
     }
     
     void MemoryManager::ReadBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, void* data)
@@ -71,19 +71,19 @@ namespace vkw
         
         if (iter != buffer_bindings_.cend())
         {
-            if (iter->second.memory_type_index & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+            if (IsHostVisible(iter->second))
             {
-                CopyFromHostVisibleBlock(device_, iter->second, size, data);
+                CopyFromHostVisibleBlock(device_, iter->second, offset, size, data);
             }
             else
             {
                 VkBuffer staging_buffer = nullptr;
                 MemoryAllocator::StorageBlock staging_block;
-                GetStagingBufferAndBlock(size, staging_buffer, staging_block);
+                GetReadbackBufferAndBlock(size, staging_buffer, staging_block);
                 
-                CopyBuffer(device_, buffer, staging_buffer, offset, 0u, size);
+                CopyBuffer(buffer, staging_buffer, offset, 0u, size);
                 
-                CopyFromHostVisibleBlock(device_, staging_block, size, data);
+                CopyFromHostVisibleBlock(device_, staging_block, 0u, size, data);
             }
         }
         else
@@ -92,28 +92,80 @@ namespace vkw
         }
     }
     
+    void* MemoryManager::MapBuffer(VkBuffer buffer)
+    {
+        auto iter = buffer_bindings_.find(buffer);
+        
+        if (iter == buffer_bindings_.cend())
+        {
+            throw std::runtime_error("VkMemoryManager: Unregistered buffer");
+        }
+        
+        if (!IsHostVisible(iter->second))
+        {
+            throw std::runtime_error("VkMemoryManager: Cannot map device local buffer");
+        }
+        
+        auto& storage_block = iter->second;
+        
+        VkMappedMemoryRange mapped_range;
+        mapped_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        mapped_range.pNext = nullptr;
+        mapped_range.memory = storage_block.memory;
+        mapped_range.offset = storage_block.offset;
+        mapped_range.size = storage_block.size;
+        
+        vkInvalidateMappedMemoryRanges(device_, 1u, &mapped_range);
+        
+        return allocator_.map(storage_block);
+    }
+    
     void MemoryManager::WriteBuffer(VkBuffer buffer,
                                       VkDeviceSize offset,
                                       VkDeviceSize size,
                                       void const* data)
+    {
+        WriteBufferRegions(buffer, { VkBufferCopy{ 0u, offset, size } }, data);
+    }
+    
+    void MemoryManager::WriteBufferRegions(VkBuffer buffer,
+                                           std::vector<VkBufferCopy> const& regions,
+                                           void const* data)
     {
         auto iter = buffer_bindings_.find(buffer);
         
         if (iter != buffer_bindings_.cend())
         {
-            if (iter->second.memory_type_index & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+            if (regions.empty())
+            {
+                return;
+            }
+            
+            if (IsHostVisible(iter->second))
             {
-                CopyToHostVisibleBlock(device_, iter->second, size, data);
+                CopyRegionsToHostVisibleBlock(device_, iter->second, regions, data);
             }
             else
             {
+                // Pack all the regions back to back in the staging buffer
+                std::vector<VkBufferCopy> staging_regions(regions.size());
+                std::vector<VkBufferCopy> device_regions(regions.size());
+                VkDeviceSize staging_size = 0u;
+                
+                for (auto i = 0u; i < regions.size(); ++i)
+                {
+                    staging_regions[i] = { regions[i].srcOffset, staging_size, regions[i].size };
+                    device_regions[i] = { staging_size, regions[i].dstOffset, regions[i].size };
+                    staging_size += regions[i].size;
+                }
+                
                 VkBuffer staging_buffer = nullptr;
                 MemoryAllocator::StorageBlock staging_block;
-                GetStagingBufferAndBlock(size, staging_buffer, staging_block);
+                GetStagingBufferAndBlock(staging_size, staging_buffer, staging_block);
                 
-                CopyToHostVisibleBlock(device_, staging_block, size, data);
+                CopyRegionsToHostVisibleBlock(device_, staging_block, staging_regions, data);
                 
-                CopyBuffer(device_, staging_buffer, buffer, 0u, offset, size);
+                CopyBuffer(staging_buffer, buffer, device_regions);
             }
         }
         else
@@ -122,14 +174,127 @@ namespace vkw
         }
     }
     
+    void MemoryManager::WriteBufferFields(void const* records,
+                                          VkDeviceSize record_stride,
+                                          std::size_t num_records,
+                                          std::vector<BufferFieldRegion> const& fields)
+    {
+        if (fields.empty() || num_records == 0u)
+        {
+            return;
+        }
+        
+        VkDeviceSize staging_size = 0u;
+        
+        for (auto& field : fields)
+        {
+            auto iter = buffer_bindings_.find(field.dst_buffer);
+            
+            if (iter == buffer_bindings_.cend())
+            {
+                throw std::runtime_error("VkMemoryManager: Unregistered buffer");
+            }
+            
+            if (field.record_offset + field.size > record_stride)
+            {
+                throw std::runtime_error("VkMemoryManager: Field does not fit in the record");
+            }
+            
+            if (field.dst_offset + field.size * num_records > iter->second.size)
+            {
+                throw std::runtime_error("VkMemoryManager: Field range does not fit in the destination buffer");
+            }
+            
+            if (!IsHostVisible(iter->second))
+            {
+                staging_size += field.size * num_records;
+            }
+        }
+        
+        VkBuffer staging_buffer = nullptr;
+        MemoryAllocator::StorageBlock staging_block;
+        
+        if (staging_size > 0u)
+        {
+            GetStagingBufferAndBlock(staging_size, staging_buffer, staging_block);
+        }
+        
+        // Host visible destinations are written in place, the rest is
+        // packed back to back in the staging buffer
+        std::vector<FieldCopy> field_copies;
+        std::vector<BufferCopyRegion> device_regions;
+        std::vector<MemoryAllocator::StorageBlock> host_visible_blocks;
+        VkDeviceSize staging_offset = 0u;
+        
+        for (auto& field : fields)
+        {
+            auto& block = buffer_bindings_[field.dst_buffer];
+            auto field_size = field.size * num_records;
+            
+            if (IsHostVisible(block))
+            {
+                field_copies.push_back({ field.record_offset,
+                                         field.size,
+                                         (char*)allocator_.map(block) + field.dst_offset });
+                host_visible_blocks.push_back(block);
+            }
+            else
+            {
+                field_copies.push_back({ field.record_offset,
+                                         field.size,
+                                         (char*)allocator_.map(staging_block) + staging_offset });
+                device_regions.push_back({ staging_buffer,
+                                           field.dst_buffer,
+                                           staging_offset,
+                                           field.dst_offset,
+                                           field_size });
+                staging_offset += field_size;
+            }
+        }
+        
+        GatherFields(*copy_pool_, records, record_stride, num_records, field_copies);
+        
+        for (auto& block : host_visible_blocks)
+        {
+            FlushHostVisibleBlock(device_, block);
+        }
+        
+        if (!device_regions.empty())
+        {
+            FlushHostVisibleBlock(device_, staging_block);
+            
+            auto command_buffer = BeginTransferCommandBuffer();
+            
+            RecordBufferCopies(command_buffer, device_regions);
+            
+            SubmitAndWait(command_buffer);
+        }
+    }
+    
     MemoryManager::MemoryManager(VkDevice device,
-                                     std::uint32_t queue_family_index,
-                                     MemoryAllocator& allocator)
+                                 ExecutionManager& execution_manager,
+                                 MemoryAllocator& allocator,
+                                 QueueType queue_type)
     : device_(device)
     , allocator_(allocator)
-    , queue_family_index_(queue_family_index)
+    , execution_manager_(execution_manager)
+    , queue_type_(queue_type)
+    , queue_family_index_(execution_manager.GetQueueFamilyIndex(queue_type))
+    , readback_memory_type_(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    , copy_pool_(new ThreadPool())
     {
+        // CPU reads from uncached (write-combined) memory are very slow
+        if (allocator_.IsMemoryTypeSupported(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT))
+        {
+            readback_memory_type_ |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        }
+        
         VkCommandPoolCreateInfo pool_create_info;
+        pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pool_create_info.pNext = nullptr;
+        // The transfer command buffer is reset implicitly on begin
+        pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        pool_create_info.queueFamilyIndex = queue_family_index_;
         
         VkCommandPool command_pool = nullptr;
         auto res = vkCreateCommandPool(device_, &pool_create_info, nullptr, &command_pool);
@@ -146,12 +311,87 @@ namespace vkw
                                                       });
     }
     
-    void MemoryManager::CopyBuffer(VkDevice device,
-                                     VkBuffer src_buffer,
+    MemoryManager::~MemoryManager()
+    {
+        // Do not release buffers a migration copy is still using
+        for (auto& iter : adaptive_buffers_)
+        {
+            CompleteMigration(iter.second, true);
+            ReleaseOldBuffer(iter.second, true);
+        }
+    }
+    
+    void MemoryManager::SetSharedQueueFamilies(std::vector<std::uint32_t> const& queue_families)
+    {
+        shared_queue_families_ = queue_families;
+        
+        std::sort(shared_queue_families_.begin(), shared_queue_families_.end());
+        shared_queue_families_.erase(std::unique(shared_queue_families_.begin(), shared_queue_families_.end()),
+                                     shared_queue_families_.end());
+    }
+    
+    void MemoryManager::SetCopyThreadCount(std::size_t num_threads)
+    {
+        copy_pool_.reset(new ThreadPool(num_threads));
+    }
+    
+    bool MemoryManager::IsHostVisible(MemoryAllocator::StorageBlock const& block) const
+    {
+        return (allocator_.GetMemoryPropertyFlags(block.memory_type_index) & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+    }
+    
+    void MemoryManager::CopyBuffer(VkBuffer src_buffer,
                                      VkBuffer dst_buffer,
                                      VkDeviceSize src_offset,
                                      VkDeviceSize dst_offset,
                                      VkDeviceSize size)
+    {
+        CopyBuffer(src_buffer, dst_buffer, { VkBufferCopy{ src_offset, dst_offset, size } });
+    }
+    
+    void MemoryManager::CopyBuffer(VkBuffer src_buffer,
+                                     VkBuffer dst_buffer,
+                                     std::vector<VkBufferCopy> const& regions)
+    {
+        auto command_buffer = BeginTransferCommandBuffer();
+        
+        vkCmdCopyBuffer(command_buffer,
+                        src_buffer,
+                        dst_buffer,
+                        (std::uint32_t)regions.size(),
+                        regions.data());
+        
+        SubmitAndWait(command_buffer);
+    }
+    
+    void MemoryManager::CopyBuffers(std::vector<BufferCopyRegion> const& regions)
+    {
+        if (regions.empty())
+        {
+            return;
+        }
+        
+        auto command_buffer = BeginTransferCommandBuffer();
+        
+        RecordBufferCopies(command_buffer, regions);
+        
+        SubmitAndWait(command_buffer);
+    }
+    
+    VkCommandBuffer MemoryManager::BeginTransferCommandBuffer()
+    {
+        // Blocking transfers are done with it by the time it is begun again
+        if (!transfer_command_buffer_)
+        {
+            transfer_command_buffer_ = AllocateCommandBuffer();
+        }
+        
+        BeginCommandBuffer(transfer_command_buffer_);
+        
+        return transfer_command_buffer_;
+    }
+    
+    VkCommandBuffer MemoryManager::AllocateCommandBuffer()
     {
         VkCommandBufferAllocateInfo command_buffer_alloc_info;
         command_buffer_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -161,40 +401,41 @@ namespace vkw
         command_buffer_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
         
         VkCommandBuffer command_buffer = nullptr;
-        vkAllocateCommandBuffers(device_, &command_buffer_alloc_info, &command_buffer);
+        auto res = vkAllocateCommandBuffers(device_, &command_buffer_alloc_info, &command_buffer);
+        
+        if (res != VK_SUCCESS)
+        {
+            throw std::runtime_error("VkMemoryManager: Cannot allocate command buffer");
+        }
         
+        return command_buffer;
+    }
+    
+    void MemoryManager::BeginCommandBuffer(VkCommandBuffer command_buffer)
+    {
         VkCommandBufferBeginInfo begin_info;
         begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
         begin_info.pNext = nullptr;
         begin_info.pInheritanceInfo = nullptr;
-        begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
         
         vkBeginCommandBuffer(command_buffer, &begin_info);
-
-        VkBufferCopy copy_region;
-        copy_region.srcOffset = src_offset;
-        copy_region.dstOffset = dst_offset;
-        copy_region.size = size;
-        vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1u, &copy_region);
-        
+    }
+    
+    void MemoryManager::SubmitAndWait(VkCommandBuffer command_buffer)
+    {
         vkEndCommandBuffer(command_buffer);
         
-        VkSubmitInfo submit_info;
-        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submit_info.pNext = nullptr;
-        submit_info.commandBufferCount = 1u;
-        submit_info.pCommandBuffers = &command_buffer;
-        submit_info.pSignalSemaphores = nullptr;
-        submit_info.signalSemaphoreCount = 0u;
-        submit_info.pWaitSemaphores = nullptr;
-        submit_info.waitSemaphoreCount = 0u;
-        submit_info.pWaitDstStageMask = nullptr;
-        
-        VkQueue queue = nullptr;
-        vkGetDeviceQueue(device_, queue_family_index_, 0u, &queue);
-        
-        vkQueueSubmit(queue, 1u, &submit_info, VK_NULL_HANDLE);
-        vkQueueWaitIdle(queue);
+        // Wait for this submission only instead of draining the queue
+        execution_manager_.Wait(Submit(command_buffer));
+    }
+    
+    Ticket MemoryManager::Submit(VkCommandBuffer command_buffer)
+    {
+        // The queue is shared with the other submitters, go through its owner.
+        // Waiting on the latest work of every queue orders the transfer after
+        // it like a submission to the same queue would be.
+        return execution_manager_.Submit(command_buffer, queue_type_, execution_manager_.GetLastTickets());
     }
     
     VkScopedObject<VkBuffer> MemoryManager::CreateBuffer(VkDeviceSize size,
@@ -217,6 +458,13 @@ namespace vkw
         buffer_create_info.queueFamilyIndexCount = 0u;
         buffer_create_info.pQueueFamilyIndices = nullptr;
         
+        if (shared_queue_families_.size() > 1u)
+        {
+            buffer_create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            buffer_create_info.queueFamilyIndexCount = (std::uint32_t)shared_queue_families_.size();
+            buffer_create_info.pQueueFamilyIndices = shared_queue_families_.data();
+        }
+        
         VkBuffer buffer = nullptr;
         auto res = vkCreateBuffer(device_, &buffer_create_info, nullptr, &buffer);
         
@@ -271,7 +519,7 @@ namespace vkw
                 
                 CopyToHostVisibleBlock(device_, staging_block, size, init_data);
                 
-                CopyBuffer(device_, staging_buffer, buffer, 0u, 0u, size);
+                CopyBuffer(staging_buffer, buffer, 0u, 0u, size);
             }
         }
     
@@ -299,6 +547,13 @@ namespace vkw
         image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
         image_create_info.usage = usage;
         
+        if (shared_queue_families_.size() > 1u)
+        {
+            image_create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            image_create_info.queueFamilyIndexCount = (std::uint32_t)shared_queue_families_.size();
+            image_create_info.pQueueFamilyIndices = shared_queue_families_.data();
+        }
+        
         VkImage image = nullptr;
         auto res = vkCreateImage(device_, &image_create_info, nullptr, &image);
         
@@ -346,22 +601,46 @@ namespace vkw
                                                  VkBuffer& buffer,
                                                  MemoryAllocator::StorageBlock& block)
     {
-        auto iter = std::find_if(staging_buffer_pool_.begin(),
-                                 staging_buffer_pool_.end(),
+        GetPooledBufferAndBlock(staging_buffer_pool_,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                size,
+                                buffer,
+                                block);
+    }
+    
+    void MemoryManager::GetReadbackBufferAndBlock(VkDeviceSize size,
+                                                  VkBuffer& buffer,
+                                                  MemoryAllocator::StorageBlock& block)
+    {
+        GetPooledBufferAndBlock(readback_buffer_pool_,
+                                readback_memory_type_,
+                                size,
+                                buffer,
+                                block);
+    }
+    
+    void MemoryManager::GetPooledBufferAndBlock(std::list<VkScopedObject<VkBuffer>>& pool,
+                                                VkMemoryPropertyFlags memory_type,
+                                                VkDeviceSize size,
+                                                VkBuffer& buffer,
+                                                MemoryAllocator::StorageBlock& block)
+    {
+        auto iter = std::find_if(pool.begin(),
+                                 pool.end(),
                                  [this, size](VkScopedObject<VkBuffer>& buffer)
                                  {
                                      auto& block = buffer_bindings_[buffer];
                                      return block.size >= size;
                                  });
         
-        if (iter == staging_buffer_pool_.cend())
+        if (iter == pool.cend())
         {
             auto staging_buffer = CreateBuffer(size,
-                                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                               memory_type,
                                                VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
                                                VK_BUFFER_USAGE_TRANSFER_DST_BIT);
             buffer = staging_buffer;
-            staging_buffer_pool_.emplace_front(std::move(staging_buffer));
+            pool.emplace_front(std::move(staging_buffer));
         }
         else
         {
@@ -370,4 +649,247 @@ namespace vkw
         
         block = buffer_bindings_[buffer];
     }
+    
+    AdaptiveBuffer MemoryManager::CreateAdaptiveBuffer(VkDeviceSize size,
+                                                       VkBufferUsageFlags usage,
+                                                       void const* init_data)
+    {
+        // Migrations copy with the transfer queue
+        usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        
+        AdaptiveBufferState state;
+        state.buffer = CreateBuffer(size, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, usage);
+        state.size = size;
+        state.usage = usage;
+        state.placement = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        state.host_accesses = 0u;
+        state.device_bindings = 0u;
+        state.migration_command_buffer = nullptr;
+        state.migration_ticket = 0u;
+        
+        if (init_data)
+        {
+            WriteBuffer(state.buffer, 0u, size, init_data);
+        }
+        
+        auto handle = next_adaptive_buffer_++;
+        adaptive_buffers_.emplace(handle, std::move(state));
+        
+        return handle;
+    }
+    
+    void MemoryManager::DestroyAdaptiveBuffer(AdaptiveBuffer buffer)
+    {
+        auto& state = GetAdaptiveBufferState(buffer);
+        
+        CompleteMigration(state, true);
+        ReleaseOldBuffer(state, true);
+        
+        adaptive_buffers_.erase(buffer);
+    }
+    
+    void MemoryManager::WriteAdaptiveBuffer(AdaptiveBuffer buffer,
+                                            VkDeviceSize offset,
+                                            VkDeviceSize size,
+                                            void const* data)
+    {
+        auto& state = GetAdaptiveBufferState(buffer);
+        
+        // The host must not race the migration copy
+        CompleteMigration(state, true);
+        
+        ++state.host_accesses;
+        WriteBuffer(state.buffer, offset, size, data);
+    }
+    
+    void MemoryManager::ReadAdaptiveBuffer(AdaptiveBuffer buffer,
+                                           VkDeviceSize offset,
+                                           VkDeviceSize size,
+                                           void* data)
+    {
+        auto& state = GetAdaptiveBufferState(buffer);
+        
+        CompleteMigration(state, true);
+        
+        ++state.host_accesses;
+        ReadBuffer(state.buffer, offset, size, data);
+    }
+    
+    VkBuffer MemoryManager::BindAdaptiveBuffer(AdaptiveBuffer buffer)
+    {
+        auto& state = GetAdaptiveBufferState(buffer);
+        
+        // The copy runs on the transfer queue, work on other queues would
+        // not be ordered after it
+        CompleteMigration(state, true);
+        
+        ++state.device_bindings;
+        return state.buffer;
+    }
+    
+    VkMemoryPropertyFlags MemoryManager::GetPlacement(AdaptiveBuffer buffer) const
+    {
+        auto iter = adaptive_buffers_.find(buffer);
+        
+        if (iter == adaptive_buffers_.cend())
+        {
+            throw std::runtime_error("VkMemoryManager: Unknown adaptive buffer");
+        }
+        
+        return iter->second.placement;
+    }
+    
+    void MemoryManager::UpdatePlacement()
+    {
+        // Ignore buffers with too few accesses to tell, and require a clear
+        // majority to move so that mixed use does not bounce back and forth
+        static std::uint32_t constexpr kMinAccesses = 8u;
+        static std::uint32_t constexpr kMajority = 2u;
+        
+        for (auto& iter : adaptive_buffers_)
+        {
+            auto& state = iter.second;
+            
+            // One migration at a time, the old buffer has to be gone first
+            if (!CompleteMigration(state, false) || state.old_buffer)
+            {
+                continue;
+            }
+            
+            auto placement = state.placement;
+            
+            if (state.host_accesses + state.device_bindings >= kMinAccesses)
+            {
+                if (state.host_accesses > kMajority * state.device_bindings)
+                {
+                    placement = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+                }
+                else if (state.device_bindings > kMajority * state.host_accesses)
+                {
+                    placement = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+                }
+            }
+            
+            // Decay, recent accesses matter more
+            state.host_accesses >>= 1;
+            state.device_bindings >>= 1;
+            
+            if (placement != state.placement)
+            {
+                Migrate(state, placement);
+            }
+        }
+    }
+    
+    MemoryManager::AdaptiveBufferState& MemoryManager::GetAdaptiveBufferState(AdaptiveBuffer buffer)
+    {
+        auto iter = adaptive_buffers_.find(buffer);
+        
+        if (iter == adaptive_buffers_.cend())
+        {
+            throw std::runtime_error("VkMemoryManager: Unknown adaptive buffer");
+        }
+        
+        return iter->second;
+    }
+    
+    void MemoryManager::Migrate(AdaptiveBufferState& state, VkMemoryPropertyFlags placement)
+    {
+        auto buffer = CreateBuffer(state.size, placement, state.usage);
+        
+        // Freed once the migration completes
+        auto command_buffer = AllocateCommandBuffer();
+        BeginCommandBuffer(command_buffer);
+        
+        // Earlier GPU writes to the buffer must land before the copy reads it
+        VkMemoryBarrier barrier;
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.pNext = nullptr;
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        
+        vkCmdPipelineBarrier(command_buffer,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0,
+                             1u, &barrier,
+                             0u, nullptr,
+                             0u, nullptr);
+        
+        VkBufferCopy region{ 0u, 0u, state.size };
+        vkCmdCopyBuffer(command_buffer, state.buffer, buffer, 1u, &region);
+        
+        // Make the copy visible to whatever is submitted next and to the host
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT | VK_ACCESS_HOST_READ_BIT;
+        
+        vkCmdPipelineBarrier(command_buffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                             0,
+                             1u, &barrier,
+                             0u, nullptr,
+                             0u, nullptr);
+        
+        vkEndCommandBuffer(command_buffer);
+        
+        state.migration_ticket = Submit(command_buffer);
+        
+        state.migration_command_buffer = command_buffer;
+        state.old_buffer = std::move(state.buffer);
+        state.buffer = std::move(buffer);
+        state.placement = placement;
+    }
+    
+    bool MemoryManager::CompleteMigration(AdaptiveBufferState& state, bool wait)
+    {
+        if (!state.migration_command_buffer)
+        {
+            ReleaseOldBuffer(state, false);
+            return true;
+        }
+        
+        if (wait)
+        {
+            execution_manager_.Wait(state.migration_ticket);
+        }
+        else if (!execution_manager_.IsComplete(state.migration_ticket))
+        {
+            return false;
+        }
+        
+        vkFreeCommandBuffers(device_, command_pool_, 1u, &state.migration_command_buffer);
+        state.migration_command_buffer = nullptr;
+        state.migration_ticket = 0u;
+        
+        // Command buffers recorded against the old buffer may have been
+        // submitted after the copy, keep it until those are done as well
+        state.retire_tickets = execution_manager_.GetLastTickets();
+        ReleaseOldBuffer(state, false);
+        
+        return true;
+    }
+    
+    void MemoryManager::ReleaseOldBuffer(AdaptiveBufferState& state, bool wait)
+    {
+        if (!state.old_buffer)
+        {
+            return;
+        }
+        
+        for (auto ticket : state.retire_tickets)
+        {
+            if (wait)
+            {
+                execution_manager_.Wait(ticket);
+            }
+            else if (!execution_manager_.IsComplete(ticket))
+            {
+                return;
+            }
+        }
+        
+        state.old_buffer = nullptr;
+        state.retire_tickets.clear();
+    }
 }
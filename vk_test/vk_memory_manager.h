@@ -23,17 +23,31 @@
 #include <vulkan/vulkan.h>
 #include "vk_memory_allocator.h"
 #include "vk_scoped_object.h"
+#include "vk_thread_pool.h"
+#include "vk_utils.h"
+#include "vk_execution_manager.h"
 #include <unordered_map>
 #include <list>
+#include <vector>
+#include <memory>
 
 namespace vkw
 {
+    // Stable handle of a buffer with adaptive placement
+    using AdaptiveBuffer = std::uint32_t;
+    
     class MemoryManager
     {
     public:
+        // Transfers go through the ExecutionManager to the queue of the given
+        // type, ordered after everything submitted to any queue before them.
+        // A transfer family of its own needs SetSharedQueueFamilies.
         MemoryManager(VkDevice device,
-                        std::uint32_t queue_family_index,
-                        MemoryAllocator& allocator);
+                      ExecutionManager& execution_manager,
+                      MemoryAllocator& allocator,
+                      QueueType queue_type = QueueType::kTransfer);
+        
+        ~MemoryManager();
         
         VkScopedObject<VkBuffer> CreateBuffer(VkDeviceSize size,
                                               VkMemoryPropertyFlags memory_type,
@@ -45,45 +59,190 @@ namespace vkw
                          VkDeviceSize size,
                          void const* data);
         
+        // Upload several ranges at once: srcOffset is an offset into data,
+        // dstOffset an offset into the buffer. Device local buffers get
+        // all of the ranges packed into one staging copy and one vkCmdCopyBuffer.
+        void WriteBufferRegions(VkBuffer buffer,
+                                std::vector<VkBufferCopy> const& regions,
+                                void const* data);
+        
+        // Upload array-of-structs records as struct-of-arrays: each field goes
+        // packed to its own buffer or sub-range. The transpose is done while
+        // filling the staging memory, device local destinations share one submit.
+        void WriteBufferFields(void const* records,
+                               VkDeviceSize record_stride,
+                               std::size_t num_records,
+                               std::vector<BufferFieldRegion> const& fields);
+        
         void ReadBuffer(VkBuffer buffer,
                         VkDeviceSize offset,
                         VkDeviceSize size,
                         void* data);
         
+        // Device to device copies with any mix of source and destination buffers
+        // (gather/scatter). Regions sharing a (src, dst) pair are issued as one
+        // vkCmdCopyBuffer. Blocks until the copies are done, use
+        // CommandBufferBuilder::CopyBuffers to record them into a command buffer instead.
+        void CopyBuffers(std::vector<BufferCopyRegion> const& regions);
+        
+        // Host pointer to a host visible buffer, device writes are made visible
+        // (invalidated) before returning. The pointer stays valid for the buffer lifetime.
+        void* MapBuffer(VkBuffer buffer);
+        
         VkScopedObject<VkImage> CreateImage(VkExtent3D size,
                                             VkFormat format,
                                             VkImageUsageFlags usage);
         
+        // Host visible memory type used for readback staging (host cached when available)
+        VkMemoryPropertyFlags GetReadbackMemoryType() const { return readback_memory_type_; }
+        
+        // Adaptive placement: the buffer starts device local and migrates between
+        // device local and host visible memory following its host accesses and
+        // GPU bindings. The handle stays valid across migrations.
+        AdaptiveBuffer CreateAdaptiveBuffer(VkDeviceSize size,
+                                            VkBufferUsageFlags usage,
+                                            void const* init_data = nullptr);
+        
+        void DestroyAdaptiveBuffer(AdaptiveBuffer buffer);
+        
+        // Host accesses, counted towards host visible placement
+        void WriteAdaptiveBuffer(AdaptiveBuffer buffer,
+                                 VkDeviceSize offset,
+                                 VkDeviceSize size,
+                                 void const* data);
+        
+        void ReadAdaptiveBuffer(AdaptiveBuffer buffer,
+                                VkDeviceSize offset,
+                                VkDeviceSize size,
+                                void* data);
+        
+        // Current VkBuffer to bind to GPU work, counted towards device local
+        // placement. Waits for a migration copy still in flight. The handle
+        // changes with UpdatePlacement: resolve again, re-set shader args and
+        // re-record command buffers using the old one before submitting more.
+        VkBuffer BindAdaptiveBuffer(AdaptiveBuffer buffer);
+        
+        VkMemoryPropertyFlags GetPlacement(AdaptiveBuffer buffer) const;
+        
+        // Check access counters and migrate buffers living in the wrong memory.
+        // The copy runs on the GPU without blocking. The old buffer is released
+        // once the copy and all the work submitted until the copy was seen
+        // complete are done.
+        void UpdatePlacement();
+        
+        // Queue families the resources are used from. With more than one,
+        // buffers and images are created with concurrent sharing so work can
+        // move between queue families without ownership transfers.
+        void SetSharedQueueFamilies(std::vector<std::uint32_t> const& queue_families);
+        
+        // Number of threads used for large copies into mapped memory (0 - one per core)
+        void SetCopyThreadCount(std::size_t num_threads);
+        
     private:
-        static void CopyToHostVisibleBlock(VkDevice device,
+        void CopyToHostVisibleBlock(VkDevice device,
+                                    MemoryAllocator::StorageBlock const& block,
+                                    VkDeviceSize size,
+                                    void const* data);
+        
+        void CopyRegionsToHostVisibleBlock(VkDevice device,
                                            MemoryAllocator::StorageBlock const& block,
-                                           VkDeviceSize size,
+                                           std::vector<VkBufferCopy> const& regions,
                                            void const* data);
         
-        static void CopyFromHostVisibleBlock(VkDevice device,
-                                             MemoryAllocator::StorageBlock const& block,
-                                             VkDeviceSize size,
-                                             void* data);
+        void FlushHostVisibleBlock(VkDevice device,
+                                   MemoryAllocator::StorageBlock const& block);
+        
+        void CopyFromHostVisibleBlock(VkDevice device,
+                                      MemoryAllocator::StorageBlock const& block,
+                                      VkDeviceSize offset,
+                                      VkDeviceSize size,
+                                      void* data);
         
         void GetStagingBufferAndBlock(VkDeviceSize size,
                                       VkBuffer& buffer,
                                       MemoryAllocator::StorageBlock& block);
         
-        void CopyBuffer(VkDevice device,
-                        VkBuffer src_buffer,
+        // Staging for device to host copies, host cached memory if available
+        void GetReadbackBufferAndBlock(VkDeviceSize size,
+                                       VkBuffer& buffer,
+                                       MemoryAllocator::StorageBlock& block);
+        
+        void GetPooledBufferAndBlock(std::list<VkScopedObject<VkBuffer>>& pool,
+                                     VkMemoryPropertyFlags memory_type,
+                                     VkDeviceSize size,
+                                     VkBuffer& buffer,
+                                     MemoryAllocator::StorageBlock& block);
+        
+        void CopyBuffer(VkBuffer src_buffer,
                         VkBuffer dst_buffer,
-                        VkDeviceSize dst_offset,
                         VkDeviceSize src_offset,
+                        VkDeviceSize dst_offset,
                         VkDeviceSize size);
         
+        void CopyBuffer(VkBuffer src_buffer,
+                        VkBuffer dst_buffer,
+                        std::vector<VkBufferCopy> const& regions);
+        
+        // Shared command buffer for blocking transfers
+        VkCommandBuffer BeginTransferCommandBuffer();
+        
+        VkCommandBuffer AllocateCommandBuffer();
+        
+        void BeginCommandBuffer(VkCommandBuffer command_buffer);
+        
+        void SubmitAndWait(VkCommandBuffer command_buffer);
+        
+        Ticket Submit(VkCommandBuffer command_buffer);
+        
+        bool IsHostVisible(MemoryAllocator::StorageBlock const& block) const;
+        
+        struct AdaptiveBufferState
+        {
+            VkScopedObject<VkBuffer> buffer;
+            VkDeviceSize size;
+            VkBufferUsageFlags usage;
+            VkMemoryPropertyFlags placement;
+            std::uint32_t host_accesses;
+            std::uint32_t device_bindings;
+            
+            // Migration in flight
+            VkScopedObject<VkBuffer> old_buffer;
+            Ticket migration_ticket;
+            VkCommandBuffer migration_command_buffer;
+            
+            // Work which may still use the old buffer once the copy is done
+            std::vector<Ticket> retire_tickets;
+        };
+        
+        AdaptiveBufferState& GetAdaptiveBufferState(AdaptiveBuffer buffer);
+        
+        void Migrate(AdaptiveBufferState& state, VkMemoryPropertyFlags placement);
+        
+        // Returns false if the migration is still running and wait is false
+        bool CompleteMigration(AdaptiveBufferState& state, bool wait);
+        
+        // Frees the old buffer once its retire tickets are complete
+        void ReleaseOldBuffer(AdaptiveBufferState& state, bool wait);
+        
         VkDevice device_;
         MemoryAllocator& allocator_;
+        ExecutionManager& execution_manager_;
+        QueueType queue_type_;
         std::uint32_t queue_family_index_;
         VkScopedObject<VkCommandPool> command_pool_;
+        VkCommandBuffer transfer_command_buffer_ = VK_NULL_HANDLE;
         
         std::unordered_map<VkBuffer, MemoryAllocator::StorageBlock> buffer_bindings_;
         std::unordered_map<VkImage, MemoryAllocator::StorageBlock> image_bindings_;
 
         std::list<VkScopedObject<VkBuffer>> staging_buffer_pool_;
+        std::list<VkScopedObject<VkBuffer>> readback_buffer_pool_;
+        VkMemoryPropertyFlags readback_memory_type_;
+        
+        std::unique_ptr<ThreadPool> copy_pool_;
+        std::vector<std::uint32_t> shared_queue_families_;
+        
+        std::unordered_map<AdaptiveBuffer, AdaptiveBufferState> adaptive_buffers_;
+        AdaptiveBuffer next_adaptive_buffer_ = 1u;
     };
 }
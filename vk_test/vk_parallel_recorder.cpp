@@ -0,0 +1,55 @@
+#include "vk_parallel_recorder.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace vkw
+{
+    ParallelRecorder::ParallelRecorder(CommandPoolManager& command_pool_manager,
+                                       ThreadPool& thread_pool,
+                                       std::size_t chunks_per_thread)
+    : command_pool_manager_(command_pool_manager)
+    , thread_pool_(thread_pool)
+    , chunks_per_thread_(std::max<std::size_t>(chunks_per_thread, 1u))
+    {
+    }
+    
+    void ParallelRecorder::Record(CommandBufferBuilder& primary, std::size_t count, RecordFunc const& record)
+    {
+        if (primary.GetStateTracker())
+        {
+            throw std::runtime_error("ParallelRecorder: State tracking is not supported, record with an untracked builder");
+        }
+        
+        if (count == 0u)
+        {
+            return;
+        }
+        
+        // Calling thread takes part in ParallelFor
+        auto num_threads = thread_pool_.GetNumThreads() + 1u;
+        auto num_chunks = std::min(count, num_threads * chunks_per_thread_);
+        auto chunk_size = (count + num_chunks - 1u) / num_chunks;
+        num_chunks = (count + chunk_size - 1u) / chunk_size;
+        
+        std::vector<VkCommandBuffer> command_buffers(num_chunks);
+        
+        thread_pool_.ParallelFor(num_chunks, [&](std::size_t chunk)
+                                 {
+                                     auto begin = chunk * chunk_size;
+                                     auto end = std::min(begin + chunk_size, count);
+                                     
+                                     CommandBufferBuilder builder(command_pool_manager_);
+                                     builder.BeginSecondaryCommandBuffer();
+                                     
+                                     for (auto i = begin; i < end; ++i)
+                                     {
+                                         record(builder, i);
+                                     }
+                                     
+                                     auto command_buffer = builder.EndCommandBuffer();
+                                     command_buffers[chunk] = command_buffer;
+                                 });
+        
+        primary.ExecuteCommands(command_buffers);
+    }
+}
@@ -0,0 +1,60 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_command_buffer_builder.h"
+#include "vk_command_pool_manager.h"
+#include "vk_thread_pool.h"
+#include <functional>
+
+namespace vkw
+{
+    // Records a range of work items on the thread pool. Items are split into
+    // contiguous chunks, each recorded into its own secondary command buffer
+    // from the recording thread's pool, and the primary executes them in item
+    // order so the result does not depend on scheduling.
+    //
+    // Record callbacks run concurrently: shaders they dispatch should have
+    // their args committed beforehand and not be modified during recording.
+    // Hazards between chunks and against the primary's tracked state can not
+    // be resolved out of order, so a primary with a state tracker is rejected:
+    // place barriers around the recorded range by hand instead.
+    class ParallelRecorder
+    {
+    public:
+        using RecordFunc = std::function<void(CommandBufferBuilder& builder, std::size_t index)>;
+        
+        static std::size_t constexpr kDefaultChunksPerThread = 2u;
+        
+        ParallelRecorder(CommandPoolManager& command_pool_manager,
+                         ThreadPool& thread_pool,
+                         std::size_t chunks_per_thread = kDefaultChunksPerThread);
+        
+        // Record items [0, count) into primary, which should have been begun
+        void Record(CommandBufferBuilder& primary, std::size_t count, RecordFunc const& record);
+        
+    private:
+        CommandPoolManager& command_pool_manager_;
+        ThreadPool& thread_pool_;
+        std::size_t chunks_per_thread_;
+    };
+}
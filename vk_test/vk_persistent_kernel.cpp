@@ -0,0 +1,153 @@
+#include "vk_persistent_kernel.h"
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+namespace vkw
+{
+    PersistentKernel::PersistentKernel(VkDevice device,
+                                       MemoryManager& memory_manager,
+                                       ShaderManager& shader_manager,
+                                       PipelineManager& pipeline_manager,
+                                       ExecutionManager& execution_manager,
+                                       VkBuffer data_buffer,
+                                       QueueType queue_type,
+                                       std::uint32_t queue_index,
+                                       std::uint32_t capacity,
+                                       std::uint32_t max_idle_spins,
+                                       std::string const& shader_file)
+    : execution_manager_(execution_manager)
+    , queue_type_(queue_type)
+    , queue_index_(queue_index == kNoQueue ? execution_manager.GetQueueCount(queue_type) - 1u : queue_index)
+    , command_buffer_builder_(device, execution_manager.GetQueueFamilyIndex(queue_type), &execution_manager)
+    , capacity_(capacity)
+    {
+        if (queue_index_ >= execution_manager_.GetQueueCount(queue_type_))
+        {
+            throw std::runtime_error("PersistentKernel: Queue index out of range");
+        }
+        
+        if (capacity_ == 0u)
+        {
+            throw std::runtime_error("PersistentKernel: Capacity can not be zero");
+        }
+        
+        auto size = (kHeaderSize + capacity_ * 4u) * sizeof(std::uint32_t);
+        queue_buffer_ = memory_manager.CreateBuffer(size,
+                                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        
+        queue_ = static_cast<std::uint32_t volatile*>(memory_manager.MapBuffer(queue_buffer_));
+        
+        for (auto i = 0u; i < kHeaderSize; ++i)
+        {
+            queue_[i] = 0u;
+        }
+        
+        shader_.reset(new Shader(shader_manager.CreateShader(VK_SHADER_STAGE_COMPUTE_BIT, shader_file)));
+        shader_->SetArg(0u, queue_buffer_);
+        shader_->SetArg(1u, data_buffer);
+        shader_->SetPushConstant("capacity", capacity_);
+        shader_->SetPushConstant("max_idle_spins", max_idle_spins);
+        
+        pipeline_ = pipeline_manager.CreateComputePipeline(*shader_, 64u, 1u, 1u);
+        
+        // A single workgroup, so jobs complete in order
+        command_buffer_builder_.BeginCommandBuffer();
+        command_buffer_builder_.Dispatch(pipeline_, *shader_, 1u, 1u, 1u);
+        command_buffer_ = command_buffer_builder_.EndCommandBuffer();
+    }
+    
+    PersistentKernel::~PersistentKernel()
+    {
+        Stop();
+    }
+    
+    std::uint32_t PersistentKernel::Load(Header word) const
+    {
+        auto value = queue_[word];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return value;
+    }
+    
+    void PersistentKernel::Store(Header word, std::uint32_t value)
+    {
+        std::atomic_thread_fence(std::memory_order_release);
+        queue_[word] = value;
+    }
+    
+    void PersistentKernel::Launch()
+    {
+        // The previous dispatch has exited or is about to
+        execution_manager_.Wait(launch_ticket_);
+        
+        Store(kQuit, 0u);
+        Store(kRunning, 1u);
+        launch_ticket_ = execution_manager_.Submit(command_buffer_, queue_type_, {}, queue_index_);
+        
+        // With batching on the dispatch would otherwise sit in the batch while
+        // Wait spins on it forever
+        execution_manager_.Flush();
+    }
+    
+    PersistentKernel::JobId PersistentKernel::Enqueue(Job const& job)
+    {
+        // Ring slot is reused once its previous job completed
+        while (next_job_ - Load(kCompleted) >= capacity_)
+        {
+            if (Load(kRunning) == 0u)
+            {
+                Launch();
+            }
+            
+            std::this_thread::yield();
+        }
+        
+        auto entry = queue_ + kHeaderSize + (next_job_ % capacity_) * 4u;
+        entry[0] = job.a_offset;
+        entry[1] = job.b_offset;
+        entry[2] = job.c_offset;
+        entry[3] = job.count;
+        
+        auto id = next_job_++;
+        Store(kHead, next_job_);
+        
+        if (Load(kRunning) == 0u)
+        {
+            Launch();
+        }
+        
+        return id;
+    }
+    
+    bool PersistentKernel::IsComplete(JobId job)
+    {
+        if (Load(kCompleted) - job - 1u < (1u << 31))
+        {
+            return true;
+        }
+        
+        // Exited idle right before the job came in
+        if (Load(kRunning) == 0u)
+        {
+            Launch();
+        }
+        
+        return false;
+    }
+    
+    void PersistentKernel::Wait(JobId job)
+    {
+        while (!IsComplete(job))
+        {
+        }
+    }
+    
+    void PersistentKernel::Stop()
+    {
+        Store(kQuit, 1u);
+        execution_manager_.Wait(launch_ticket_);
+        Store(kRunning, 0u);
+    }
+}
@@ -0,0 +1,122 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_scoped_object.h"
+#include "vk_memory_manager.h"
+#include "vk_shader_manager.h"
+#include "vk_pipeline_manager.h"
+#include "vk_execution_manager.h"
+#include "vk_command_buffer_builder.h"
+#include <memory>
+#include <string>
+
+namespace vkw
+{
+    // Low latency mode for tiny jobs: one long running dispatch polls a job
+    // ring in host visible memory, the host enqueues by writing the job and
+    // bumping a counter, and waits by polling the completed counter. No
+    // command buffer, vkQueueSubmit or fence per job.
+    //
+    // Relies on coherent memory being observed by a running dispatch and by
+    // the host, which holds on unified memory and software ICDs but is not
+    // guaranteed by the spec. The kernel exits after idling for a while so it
+    // does not trip the GPU watchdog, and is relaunched on demand. Meant to be
+    // driven from a single thread.
+    class PersistentKernel
+    {
+    public:
+        using JobId = std::uint32_t;
+        
+        // Element offsets into the data buffer: c[i] = a[i] + b[i] for i < count
+        struct Job
+        {
+            std::uint32_t a_offset;
+            std::uint32_t b_offset;
+            std::uint32_t c_offset;
+            std::uint32_t count;
+        };
+        
+        static std::uint32_t constexpr kDefaultCapacity = 256u;
+        static std::uint32_t constexpr kDefaultMaxIdleSpins = 1u << 20;
+        
+        // Data buffer is a storage buffer of ints, host visible if the host reads results directly.
+        // The kernel occupies its queue while running: by default it takes the last
+        // compute queue, which is a dedicated one when the family has several.
+        PersistentKernel(VkDevice device,
+                         MemoryManager& memory_manager,
+                         ShaderManager& shader_manager,
+                         PipelineManager& pipeline_manager,
+                         ExecutionManager& execution_manager,
+                         VkBuffer data_buffer,
+                         QueueType queue_type = QueueType::kCompute,
+                         std::uint32_t queue_index = kNoQueue,
+                         std::uint32_t capacity = kDefaultCapacity,
+                         std::uint32_t max_idle_spins = kDefaultMaxIdleSpins,
+                         std::string const& shader_file = "persistent.comp.spv");
+        
+        // Stops the kernel
+        ~PersistentKernel();
+        
+        // Blocks while the ring is full
+        JobId Enqueue(Job const& job);
+        
+        bool IsComplete(JobId job);
+        
+        // Spins on the completed counter
+        void Wait(JobId job);
+        
+        // Quit and wait for the dispatch to finish
+        void Stop();
+        
+    private:
+        // Header words in front of the job ring
+        enum Header
+        {
+            kHead = 0,
+            kCompleted,
+            kQuit,
+            kRunning,
+            kHeaderSize
+        };
+        
+        std::uint32_t Load(Header word) const;
+        void Store(Header word, std::uint32_t value);
+        void Launch();
+        
+        ExecutionManager& execution_manager_;
+        QueueType queue_type_;
+        std::uint32_t queue_index_;
+        CommandBufferBuilder command_buffer_builder_;
+        std::uint32_t capacity_;
+        
+        VkScopedObject<VkBuffer> queue_buffer_;
+        // Persistently mapped, coherent
+        std::uint32_t volatile* queue_ = nullptr;
+        
+        std::unique_ptr<Shader> shader_;
+        ComputePipeline pipeline_;
+        CommandBuffer command_buffer_;
+        Ticket launch_ticket_ = 0u;
+        JobId next_job_ = 0u;
+    };
+}
@@ -58,7 +58,8 @@ namespace vkw
     ComputePipeline PipelineManager::CreateComputePipeline(Shader& shader,
                                                            std::size_t group_size_x,
                                                            std::size_t group_size_y,
-                                                           std::size_t group_size_z)
+                                                           std::size_t group_size_z,
+                                                           std::vector<std::uint32_t> const& specialization_constants)
     {
         ComputePipeline pipeline;
         
@@ -85,19 +86,31 @@ namespace vkw
                                                                vkDestroyPipelineLayout(device, layout, nullptr);
                                                            });
         
-        VkSpecializationMapEntry entries[] =
+        // Specialization constants are 32-bit uints, local size first
+        std::vector<std::uint32_t> constants =
         {
-            {0u, 0u, sizeof(std::size_t)},
-            {1u, sizeof(std::size_t), sizeof(std::size_t)},
-            {2u, 2 * sizeof(std::size_t), sizeof(std::size_t)}
+            (std::uint32_t)group_size_x,
+            (std::uint32_t)group_size_y,
+            (std::uint32_t)group_size_z
         };
+        constants.insert(constants.end(), specialization_constants.cbegin(), specialization_constants.cend());
+        
+        std::vector<VkSpecializationMapEntry> entries(constants.size());
+        for (auto i = 0u; i < constants.size(); ++i)
+        {
+            entries[i] = { i, (std::uint32_t)(i * sizeof(std::uint32_t)), sizeof(std::uint32_t) };
+        }
         
-        std::size_t group_size[] = { group_size_x, group_size_y, group_size_z };
         VkSpecializationInfo specialization_info;
-        specialization_info.mapEntryCount = 3u;
-        specialization_info.dataSize = sizeof(std::size_t) * 3u;
-        specialization_info.pMapEntries = entries;
-        specialization_info.pData = group_size;
+        specialization_info.mapEntryCount = (std::uint32_t)entries.size();
+        specialization_info.dataSize = sizeof(std::uint32_t) * constants.size();
+        specialization_info.pMapEntries = entries.data();
+        specialization_info.pData = constants.data();
+        
+        for (auto i = 0u; i < 3u; ++i)
+        {
+            pipeline.group_size[i] = shader.local_size[i] ? shader.local_size[i] : constants[i];
+        }
         
         VkComputePipelineCreateInfo pipeline_create_info;
         pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
@@ -34,6 +34,8 @@ namespace vkw
     {
         VkScopedObject<VkPipeline> pipeline;
         VkScopedObject<VkPipelineLayout> layout;
+        // Local size the pipeline runs with
+        std::uint32_t group_size[3];
     };
     
     struct GraphicsPipelineState
@@ -71,10 +73,13 @@ namespace vkw
                                                 VkRenderPass render_pass,
                                                 GraphicsPipelineState* create_state = nullptr);
         
+        // Group size goes to specialization constants 0-2 unless the shader
+        // has a fixed local size, extra constants get ids starting from 3
         ComputePipeline CreateComputePipeline(Shader& shader,
                                               std::size_t group_size_x,
                                               std::size_t group_size_y,
-                                              std::size_t group_size_z);
+                                              std::size_t group_size_z,
+                                              std::vector<std::uint32_t> const& specialization_constants = {});
         
     private:
         VkPipelineInputAssemblyStateCreateInfo  default_assembly_state_;
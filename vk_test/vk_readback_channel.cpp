@@ -0,0 +1,189 @@
+#include "vk_readback_channel.h"
+#include <stdexcept>
+
+namespace vkw
+{
+    ReadbackChannel::ReadbackChannel(VkDevice device,
+                                     ExecutionManager& execution_manager,
+                                     MemoryManager& memory_manager,
+                                     VkDeviceSize max_size,
+                                     QueueType queue_type)
+    : device_(device)
+    , execution_manager_(execution_manager)
+    , queue_type_(queue_type)
+    , memory_manager_(memory_manager)
+    , max_size_(max_size)
+    , slots_(kNumSlots)
+    {
+        VkCommandPoolCreateInfo pool_create_info;
+        pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pool_create_info.pNext = nullptr;
+        pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        pool_create_info.queueFamilyIndex = execution_manager_.GetQueueFamilyIndex(queue_type_);
+        
+        VkCommandPool command_pool = nullptr;
+        auto res = vkCreateCommandPool(device, &pool_create_info, nullptr, &command_pool);
+        
+        if (res != VK_SUCCESS)
+        {
+            throw std::runtime_error("ReadbackChannel: Cannot create command pool");
+        }
+        
+        command_pool_ = VkScopedObject<VkCommandPool>(command_pool,
+                                                      [device](VkCommandPool pool)
+                                                      {
+                                                          vkDestroyCommandPool(device, pool, nullptr);
+                                                      });
+        
+        for (auto& slot : slots_)
+        {
+            slot.staging_buffer = memory_manager_.CreateBuffer(max_size,
+                                                               memory_manager_.GetReadbackMemoryType(),
+                                                               VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+            
+            VkCommandBufferAllocateInfo command_buffer_alloc_info;
+            command_buffer_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            command_buffer_alloc_info.pNext = nullptr;
+            command_buffer_alloc_info.commandPool = command_pool_;
+            command_buffer_alloc_info.commandBufferCount = 1u;
+            command_buffer_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            
+            res = vkAllocateCommandBuffers(device, &command_buffer_alloc_info, &slot.command_buffer);
+            
+            if (res != VK_SUCCESS)
+            {
+                throw std::runtime_error("ReadbackChannel: Cannot allocate command buffer");
+            }
+        }
+    }
+    
+    ReadbackChannel::~ReadbackChannel()
+    {
+        // Staging buffers and command buffers must not be released while in use
+        for (auto& slot : slots_)
+        {
+            if (slot.in_flight)
+            {
+                execution_manager_.Wait(slot.ticket);
+            }
+        }
+    }
+    
+    void ReadbackChannel::Enqueue(VkBuffer buffer,
+                                  VkDeviceSize offset,
+                                  VkDeviceSize size,
+                                  Callback callback)
+    {
+        if (size > max_size_)
+        {
+            throw std::runtime_error("ReadbackChannel: Readback size exceeds channel capacity");
+        }
+        
+        auto& slot = slots_[next_slot_];
+        
+        if (slot.in_flight)
+        {
+            // Every slot is busy, this is the oldest one
+            execution_manager_.Wait(slot.ticket);
+            Deliver(slot);
+        }
+        
+        VkCommandBufferBeginInfo begin_info;
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.pNext = nullptr;
+        begin_info.pInheritanceInfo = nullptr;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        
+        vkBeginCommandBuffer(slot.command_buffer, &begin_info);
+        
+        // Make writes of work previously submitted to the queue available to the copy
+        VkMemoryBarrier barrier;
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.pNext = nullptr;
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        
+        vkCmdPipelineBarrier(slot.command_buffer,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0u,
+                             1u,
+                             &barrier,
+                             0u,
+                             nullptr,
+                             0u,
+                             nullptr);
+        
+        VkBufferCopy copy_region;
+        copy_region.srcOffset = offset;
+        copy_region.dstOffset = 0u;
+        copy_region.size = size;
+        vkCmdCopyBuffer(slot.command_buffer, buffer, slot.staging_buffer, 1u, &copy_region);
+        
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        
+        vkCmdPipelineBarrier(slot.command_buffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                             0u,
+                             1u,
+                             &barrier,
+                             0u,
+                             nullptr,
+                             0u,
+                             nullptr);
+        
+        vkEndCommandBuffer(slot.command_buffer);
+        
+        // Through the queue's owner, after the latest work of every queue
+        slot.ticket = execution_manager_.Submit(slot.command_buffer,
+                                                queue_type_,
+                                                execution_manager_.GetLastTickets());
+        
+        slot.size = size;
+        slot.callback = std::move(callback);
+        slot.in_flight = true;
+        
+        next_slot_ = (next_slot_ + 1) % kNumSlots;
+    }
+    
+    std::uint32_t ReadbackChannel::Poll()
+    {
+        auto num_delivered = 0u;
+        
+        // Deliver in submission order, stop at the first one still running
+        while (slots_[oldest_slot_].in_flight &&
+               execution_manager_.IsComplete(slots_[oldest_slot_].ticket))
+        {
+            Deliver(slots_[oldest_slot_]);
+            ++num_delivered;
+        }
+        
+        return num_delivered;
+    }
+    
+    void ReadbackChannel::Flush()
+    {
+        while (slots_[oldest_slot_].in_flight)
+        {
+            auto& slot = slots_[oldest_slot_];
+            execution_manager_.Wait(slot.ticket);
+            Deliver(slot);
+        }
+    }
+    
+    void ReadbackChannel::Deliver(Slot& slot)
+    {
+        slot.in_flight = false;
+        oldest_slot_ = (oldest_slot_ + 1) % kNumSlots;
+        
+        auto callback = std::move(slot.callback);
+        slot.callback = nullptr;
+        
+        if (callback)
+        {
+            callback(memory_manager_.MapBuffer(slot.staging_buffer), slot.size);
+        }
+    }
+}
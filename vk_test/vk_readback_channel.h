@@ -0,0 +1,89 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_scoped_object.h"
+#include "vk_memory_manager.h"
+#include "vk_execution_manager.h"
+#include <functional>
+#include <vector>
+
+namespace vkw
+{
+    // Persistent double-buffered device to host channel. A readback is
+    // copied into one slot while the CPU consumes the other one, results
+    // are delivered in order through callbacks from Poll() or Flush().
+    class ReadbackChannel
+    {
+    public:
+        using Callback = std::function<void(void const* data, VkDeviceSize size)>;
+        
+        static std::uint32_t constexpr kNumSlots = 2u;
+        
+        // Copies go to the queue of the given type through the ExecutionManager
+        ReadbackChannel(VkDevice device,
+                        ExecutionManager& execution_manager,
+                        MemoryManager& memory_manager,
+                        VkDeviceSize max_size,
+                        QueueType queue_type = QueueType::kTransfer);
+        
+        ~ReadbackChannel();
+        
+        // Submit a copy of the buffer range into the next slot. Blocks only
+        // if every slot is still in flight, delivering the oldest one first.
+        // Buffer needs TRANSFER_SRC usage.
+        void Enqueue(VkBuffer buffer,
+                     VkDeviceSize offset,
+                     VkDeviceSize size,
+                     Callback callback);
+        
+        // Deliver finished readbacks without blocking, returns the number delivered
+        std::uint32_t Poll();
+        
+        // Block until all the readbacks in flight are delivered
+        void Flush();
+        
+    private:
+        struct Slot
+        {
+            VkScopedObject<VkBuffer> staging_buffer;
+            Ticket ticket = 0u;
+            VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+            VkDeviceSize size = 0u;
+            Callback callback;
+            bool in_flight = false;
+        };
+        
+        void Deliver(Slot& slot);
+        
+        VkDevice device_;
+        ExecutionManager& execution_manager_;
+        QueueType queue_type_;
+        MemoryManager& memory_manager_;
+        VkDeviceSize max_size_;
+        VkScopedObject<VkCommandPool> command_pool_;
+        std::vector<Slot> slots_;
+        // Next slot to submit to, slots are delivered in the same round-robin order
+        std::uint32_t next_slot_ = 0u;
+        std::uint32_t oldest_slot_ = 0u;
+    };
+}
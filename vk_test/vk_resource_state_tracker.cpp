@@ -0,0 +1,125 @@
+#include "vk_resource_state_tracker.h"
+
+namespace vkw
+{
+    ResourceBarrier ResourceState::Access(VkPipelineStageFlags stage,
+                                          VkAccessFlags access,
+                                          VkImageLayout new_layout,
+                                          bool write)
+    {
+        ResourceBarrier barrier;
+        auto transition = new_layout != layout;
+        
+        if (write || transition)
+        {
+            // Layout transitions write the image, same as WAR/WAW
+            barrier.src_stage = write_stage | read_stages;
+            
+            if (barrier.src_stage == 0u && transition)
+            {
+                barrier.src_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            }
+        }
+        else if (write_stage != 0u &&
+                 ((stage & ~visible_stages) != 0u || (access & ~visible_access) != 0u))
+        {
+            // RAW not covered by an earlier barrier
+            barrier.src_stage = write_stage;
+        }
+        
+        if (barrier.src_stage != 0u)
+        {
+            barrier.dst_stage = stage;
+            barrier.src_access = write_access;
+            barrier.dst_access = access;
+            barrier.old_layout = layout;
+            barrier.new_layout = new_layout;
+        }
+        
+        if (write)
+        {
+            write_stage = stage;
+            write_access = access;
+            read_stages = 0u;
+            visible_stages = 0u;
+            visible_access = 0u;
+        }
+        else if (transition)
+        {
+            // Earlier reads are ordered before the transition, later stages chain onto this one
+            write_stage = stage;
+            read_stages = stage;
+            visible_stages = stage;
+            visible_access = access;
+        }
+        else
+        {
+            if (barrier.src_stage != 0u)
+            {
+                visible_stages |= stage;
+                visible_access |= access;
+            }
+            
+            read_stages |= stage;
+        }
+        
+        layout = new_layout;
+        
+        return barrier;
+    }
+    
+    ResourceBarrier ResourceStateTracker::AccessBuffer(VkBuffer buffer,
+                                                       std::uint32_t queue_family_index,
+                                                       VkPipelineStageFlags stage,
+                                                       VkAccessFlags access)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return Access(buffers_[buffer], queue_family_index, stage, access, VK_IMAGE_LAYOUT_UNDEFINED);
+    }
+    
+    ResourceBarrier ResourceStateTracker::AccessImage(VkImage image,
+                                                      std::uint32_t queue_family_index,
+                                                      VkPipelineStageFlags stage,
+                                                      VkAccessFlags access,
+                                                      VkImageLayout layout)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return Access(images_[image], queue_family_index, stage, access, layout);
+    }
+    
+    ResourceBarrier ResourceStateTracker::Access(TrackedState& tracked,
+                                                 std::uint32_t queue_family_index,
+                                                 VkPipelineStageFlags stage,
+                                                 VkAccessFlags access,
+                                                 VkImageLayout layout)
+    {
+        if (tracked.queue_family_index != queue_family_index)
+        {
+            // Only the layout survives the queue change
+            auto current_layout = tracked.state.layout;
+            tracked.state = ResourceState();
+            tracked.state.layout = current_layout;
+            tracked.queue_family_index = queue_family_index;
+        }
+        
+        return tracked.state.Access(stage, access, layout, (access & kWriteAccessMask) != 0u);
+    }
+    
+    void ResourceStateTracker::SetImageLayout(VkImage image, VkImageLayout layout)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        images_[image].state.layout = layout;
+    }
+    
+    void ResourceStateTracker::Forget(VkBuffer buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers_.erase(buffer);
+    }
+    
+    void ResourceStateTracker::Forget(VkImage image)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        images_.erase(image);
+    }
+}
@@ -0,0 +1,113 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include <mutex>
+#include <unordered_map>
+
+namespace vkw
+{
+    // Access masks that modify memory
+    static VkAccessFlags constexpr kWriteAccessMask =
+        VK_ACCESS_SHADER_WRITE_BIT |
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_TRANSFER_WRITE_BIT |
+        VK_ACCESS_HOST_WRITE_BIT |
+        VK_ACCESS_MEMORY_WRITE_BIT;
+    
+    // Barrier to put in front of an access, src_stage is 0 if none is needed
+    struct ResourceBarrier
+    {
+        VkPipelineStageFlags src_stage = 0u;
+        VkPipelineStageFlags dst_stage = 0u;
+        VkAccessFlags src_access = 0u;
+        VkAccessFlags dst_access = 0u;
+        VkImageLayout old_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkImageLayout new_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    };
+    
+    // Last access to a buffer or image
+    struct ResourceState
+    {
+        VkPipelineStageFlags write_stage = 0u;
+        VkAccessFlags write_access = 0u;
+        // Stages reading since the last write
+        VkPipelineStageFlags read_stages = 0u;
+        // Stages and accesses the last write has been made visible to
+        VkPipelineStageFlags visible_stages = 0u;
+        VkAccessFlags visible_access = 0u;
+        // Always undefined for buffers
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        
+        // Barrier needed for RAW, WAR, WAW hazards and layout transitions
+        // before the access, the state is updated to include it.
+        // Read-after-read never needs one.
+        ResourceBarrier Access(VkPipelineStageFlags stage,
+                               VkAccessFlags access,
+                               VkImageLayout new_layout,
+                               bool write);
+    };
+    
+    // Last access to every buffer and image recorded through the builders
+    // sharing the tracker, assuming command buffers execute in the order they
+    // are recorded in. Work on another queue family needs a ticket wait,
+    // which covers the hazard, so the state starts over on a family change.
+    class ResourceStateTracker
+    {
+    public:
+        ResourceBarrier AccessBuffer(VkBuffer buffer,
+                                     std::uint32_t queue_family_index,
+                                     VkPipelineStageFlags stage,
+                                     VkAccessFlags access);
+        
+        ResourceBarrier AccessImage(VkImage image,
+                                    std::uint32_t queue_family_index,
+                                    VkPipelineStageFlags stage,
+                                    VkAccessFlags access,
+                                    VkImageLayout layout);
+        
+        // Layout of an image transitioned outside of the tracker
+        void SetImageLayout(VkImage image, VkImageLayout layout);
+        
+        // Should be called when the object is destroyed, handles get reused
+        void Forget(VkBuffer buffer);
+        void Forget(VkImage image);
+        
+    private:
+        struct TrackedState
+        {
+            ResourceState state;
+            std::uint32_t queue_family_index = VK_QUEUE_FAMILY_IGNORED;
+        };
+        
+        ResourceBarrier Access(TrackedState& tracked,
+                               std::uint32_t queue_family_index,
+                               VkPipelineStageFlags stage,
+                               VkAccessFlags access,
+                               VkImageLayout layout);
+        
+        std::mutex mutex_;
+        std::unordered_map<VkBuffer, TrackedState> buffers_;
+        std::unordered_map<VkImage, TrackedState> images_;
+    };
+}
@@ -1,4 +1,5 @@
 #include "vk_shader_manager.h"
+#include <cstring>
 #include <fstream>
 #include <vector>
 #include <algorithm>
@@ -240,6 +241,67 @@ namespace vkw
         }
     }
     
+    void ShaderManager::PopulateBindingAccess(spirv_cross::CompilerGLSL& glsl,
+                                              Shader& shader)
+    {
+        spirv_cross::ShaderResources resources = glsl.get_shader_resources();
+        
+        auto set_access = [&](spirv_cross::Resource const& resource, VkAccessFlags access)
+        {
+            auto iter = shader.bindings.find(glsl.get_decoration(resource.id, spv::DecorationBinding));
+            
+            if (iter != shader.bindings.end())
+            {
+                iter->second.access = access;
+            }
+        };
+        
+        // readonly/writeonly blocks decorate either the variable or all of the members
+        for (auto& resource: resources.storage_buffers)
+        {
+            auto& type = glsl.get_type(resource.base_type_id);
+            
+            auto readable = !glsl.has_decoration(resource.id, spv::DecorationNonReadable);
+            auto writable = !glsl.has_decoration(resource.id, spv::DecorationNonWritable);
+            auto any_readable_member = type.member_types.empty();
+            auto any_writable_member = type.member_types.empty();
+            
+            for (auto i = 0u; i < type.member_types.size(); ++i)
+            {
+                any_readable_member = any_readable_member ||
+                    !glsl.get_member_decoration(resource.base_type_id, i, spv::DecorationNonReadable);
+                any_writable_member = any_writable_member ||
+                    !glsl.get_member_decoration(resource.base_type_id, i, spv::DecorationNonWritable);
+            }
+            
+            set_access(resource,
+                       (readable && any_readable_member ? (VkAccessFlags)VK_ACCESS_SHADER_READ_BIT : 0u) |
+                       (writable && any_writable_member ? (VkAccessFlags)VK_ACCESS_SHADER_WRITE_BIT : 0u));
+        }
+        
+        for (auto& resource: resources.storage_images)
+        {
+            set_access(resource,
+                       (glsl.has_decoration(resource.id, spv::DecorationNonReadable) ? 0u : (VkAccessFlags)VK_ACCESS_SHADER_READ_BIT) |
+                       (glsl.has_decoration(resource.id, spv::DecorationNonWritable) ? 0u : (VkAccessFlags)VK_ACCESS_SHADER_WRITE_BIT));
+        }
+        
+        for (auto& resource: resources.uniform_buffers)
+        {
+            set_access(resource, VK_ACCESS_UNIFORM_READ_BIT);
+        }
+        
+        for (auto& resource: resources.sampled_images)
+        {
+            set_access(resource, VK_ACCESS_SHADER_READ_BIT);
+        }
+        
+        for (auto& resource: resources.separate_images)
+        {
+            set_access(resource, VK_ACCESS_SHADER_READ_BIT);
+        }
+    }
+    
     void
     ShaderManager::CreateShaderModule(VkShaderStageFlags binding_stage_flags,
                                       std::vector<std::uint32_t> const& bytecode,
@@ -278,6 +340,7 @@ namespace vkw
                     Shader::Binding binding;
                     binding.type = b.descriptorType;
                     binding.ptr = nullptr;
+                    binding.access = 0u;
                     shader.bindings[b.binding + i] = binding;
                 }
             }
@@ -285,6 +348,8 @@ namespace vkw
             shader.device = device_;
         }
         
+        PopulateBindingAccess(glsl, shader);
+        
         shader.layout = VkScopedObject<VkDescriptorSetLayout>(raw_layout,
                                                               [this](VkDescriptorSetLayout layout)
                                                               {
@@ -297,21 +362,55 @@ namespace vkw
         spirv_cross::ShaderResources resources = glsl.get_shader_resources();
         
         shader.push_constant_ranges.clear();
+        shader.push_constants.clear();
+        shader.push_constant_data.clear();
         if (!resources.push_constant_buffers.empty())
         {
-            auto ranges = glsl.get_active_buffer_ranges(resources.push_constant_buffers.front().id);
+            auto& block = resources.push_constant_buffers.front();
+            auto ranges = glsl.get_active_buffer_ranges(block.id);
             
-            std::transform(ranges.cbegin(),
-                           ranges.cend(),
-                           std::back_inserter(shader.push_constant_ranges),
-                           [binding_stage_flags](spirv_cross::BufferRange const& range)
-                           {
-                               VkPushConstantRange push_constant_range;
-                               push_constant_range.stageFlags = binding_stage_flags;
-                               push_constant_range.offset = (std::uint32_t)range.offset;
-                               push_constant_range.size = (std::uint32_t)range.range;
-                               return push_constant_range;
-                           });
+            // A stage can only appear in one range of the layout, merge the active members
+            if (!ranges.empty())
+            {
+                auto begin = ranges.front().offset;
+                auto end = ranges.front().offset + ranges.front().range;
+                
+                for (auto& range : ranges)
+                {
+                    begin = std::min(begin, range.offset);
+                    end = std::max(end, range.offset + range.range);
+                }
+                
+                VkPushConstantRange push_constant_range;
+                push_constant_range.stageFlags = binding_stage_flags;
+                push_constant_range.offset = (std::uint32_t)begin;
+                push_constant_range.size = (std::uint32_t)(end - begin);
+                shader.push_constant_ranges.push_back(push_constant_range);
+            }
+            
+            auto& type = glsl.get_type(block.base_type_id);
+            
+            for (auto i = 0u; i < type.member_types.size(); ++i)
+            {
+                Shader::PushConstant push_constant;
+                push_constant.name = glsl.get_member_name(block.base_type_id, i);
+                push_constant.offset = glsl.type_struct_member_offset(type, i);
+                push_constant.size = (std::uint32_t)glsl.get_declared_struct_member_size(type, i);
+                shader.push_constants.push_back(push_constant);
+            }
+            
+            shader.push_constant_data.resize(glsl.get_declared_struct_size(type));
+        }
+        
+        if (binding_stage_flags == VK_SHADER_STAGE_COMPUTE_BIT)
+        {
+            spirv_cross::SpecializationConstant constants[3];
+            glsl.get_work_group_size_specialization_constants(constants[0], constants[1], constants[2]);
+            
+            for (auto i = 0u; i < 3u; ++i)
+            {
+                shader.local_size[i] = constants[i].id ? 0u : glsl.get_execution_mode_argument(spv::ExecutionModeLocalSize, i);
+            }
         }
         
         if (binding_stage_flags == VK_SHADER_STAGE_VERTEX_BIT)
@@ -441,7 +540,7 @@ namespace vkw
     {
         auto iter = bindings.find(idx);
         
-        if (IsImageType(iter->second.type))
+        if (!IsImageType(iter->second.type))
         {
             throw std::runtime_error("Shader: Shader argument type mismatch");
         }
@@ -470,6 +569,48 @@ namespace vkw
         }
     }
     
+    void Shader::SetPushConstant(std::string const& name, void const* data, std::size_t size)
+    {
+        auto iter = std::find_if(push_constants.cbegin(), push_constants.cend(),
+                                 [&name](PushConstant const& push_constant)
+                                 {
+                                     return push_constant.name == name;
+                                 });
+        
+        if (iter == push_constants.cend())
+        {
+            throw std::runtime_error("Shader: No push constant named " + name);
+        }
+        
+        SetPushConstant((std::uint32_t)(iter - push_constants.cbegin()), data, size);
+    }
+    
+    bool Shader::HasPushConstant(std::string const& name) const
+    {
+        return std::any_of(push_constants.cbegin(), push_constants.cend(),
+                           [&name](PushConstant const& push_constant)
+                           {
+                               return push_constant.name == name;
+                           });
+    }
+    
+    void Shader::SetPushConstant(std::uint32_t index, void const* data, std::size_t size)
+    {
+        if (index >= push_constants.size())
+        {
+            throw std::runtime_error("Shader: Push constant index out of range");
+        }
+        
+        auto& push_constant = push_constants[index];
+        
+        if (size != push_constant.size)
+        {
+            throw std::runtime_error("Shader: Push constant size mismatch for " + push_constant.name);
+        }
+        
+        std::memcpy(push_constant_data.data() + push_constant.offset, data, size);
+    }
+    
     void Shader::CommitArgs()
     {
         if (!dirty)
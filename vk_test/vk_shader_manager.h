@@ -35,6 +35,19 @@ namespace vkw
         void SetArg(std::uint32_t idx, VkImage image);
         void SetArg(std::uint32_t idx, VkSampler sampler);
         void CommitArgs();
+        
+        // Push constants by reflected member name or index, recorded by the next dispatch
+        void SetPushConstant(std::string const& name, void const* data, std::size_t size);
+        void SetPushConstant(std::uint32_t index, void const* data, std::size_t size);
+        
+        template <typename T>
+        void SetPushConstant(std::string const& name, T const& value) { SetPushConstant(name, &value, sizeof(T)); }
+        
+        template <typename T>
+        void SetPushConstant(std::uint32_t index, T const& value) { SetPushConstant(index, &value, sizeof(T)); }
+        
+        bool HasPushConstant(std::string const& name) const;
+        
         void SetDirty() { dirty = true; }
         void ClearDirty() { dirty = false; }
         
@@ -42,8 +55,23 @@ namespace vkw
         VkScopedObject<VkDescriptorSetLayout> layout;
         VkScopedObject<VkDescriptorSet> descriptor_set;
         
+        // Single range covering the members the shader uses
         std::vector<VkPushConstantRange> push_constant_ranges;
         
+        struct PushConstant
+        {
+            std::string name;
+            std::uint32_t offset;
+            std::uint32_t size;
+        };
+        
+        std::vector<PushConstant> push_constants;
+        // Whole push constant block
+        std::vector<std::uint8_t> push_constant_data;
+        
+        // Compute local size reflected from the module, 0 where it comes from a specialization constant
+        std::uint32_t local_size[3] = { 0u, 0u, 0u };
+        
         uint32_t vertex_stride;
         std::vector<VkVertexInputAttributeDescription> vertex_attributes;
         
@@ -58,6 +86,8 @@ namespace vkw
             };
             
             VkDescriptorType type;
+            // Reflected from NonReadable/NonWritable decorations
+            VkAccessFlags access;
         };
         
         VkDevice device;
@@ -93,6 +123,9 @@ namespace vkw
                                      VkShaderStageFlags stage_flags,
                                      std::vector<VkDescriptorSetLayoutBinding>& bindings);
         
+        static void PopulateBindingAccess(spirv_cross::CompilerGLSL& glsl,
+                                          Shader& shader);
+        
         static VkFormat BaseTypeToVkFormat(spirv_cross::SPIRType type);
         
         VkDevice device_;
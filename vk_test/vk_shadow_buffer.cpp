@@ -0,0 +1,102 @@
+#include "vk_shadow_buffer.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace vkw
+{
+    ShadowBuffer::ShadowBuffer(MemoryManager& memory_manager,
+                               VkDeviceSize size,
+                               VkBufferUsageFlags usage,
+                               VkDeviceSize granularity)
+    : memory_manager_(memory_manager)
+    , granularity_(std::max<VkDeviceSize>(granularity, 1u))
+    , shadow_((std::size_t)size, 0)
+    {
+        buffer_ = memory_manager_.CreateBuffer(size,
+                                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                               usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        
+        // Device contents are undefined, the first Sync uploads everything
+        MarkDirty(0u, size);
+    }
+    
+    void ShadowBuffer::Write(VkDeviceSize offset, VkDeviceSize size, void const* data)
+    {
+        // Written so that offset + size can not wrap around
+        if (size > GetSize() || offset > GetSize() - size)
+        {
+            throw std::runtime_error("ShadowBuffer: Write out of bounds");
+        }
+        
+        std::memcpy(shadow_.data() + offset, data, (std::size_t)size);
+        MarkDirty(offset, size);
+    }
+    
+    void ShadowBuffer::MarkDirty(VkDeviceSize offset, VkDeviceSize size)
+    {
+        if (size > GetSize() || offset > GetSize() - size)
+        {
+            throw std::runtime_error("ShadowBuffer: Dirty range out of bounds");
+        }
+        
+        if (size == 0u)
+        {
+            return;
+        }
+        
+        auto begin = offset / granularity_ * granularity_;
+        auto end = std::min(GetSize(), (offset + size + granularity_ - 1) / granularity_ * granularity_);
+        
+        // First range which might touch [begin, end): the one starting at or before begin
+        auto iter = dirty_ranges_.upper_bound(begin);
+        
+        if (iter != dirty_ranges_.begin() && std::prev(iter)->second >= begin)
+        {
+            --iter;
+        }
+        
+        // Absorb every range overlapping or adjacent to the new one
+        while (iter != dirty_ranges_.end() && iter->first <= end)
+        {
+            begin = std::min(begin, iter->first);
+            end = std::max(end, iter->second);
+            iter = dirty_ranges_.erase(iter);
+        }
+        
+        dirty_ranges_.emplace(begin, end);
+    }
+    
+    VkDeviceSize ShadowBuffer::GetDirtySize() const
+    {
+        VkDeviceSize size = 0u;
+        
+        for (auto& range : dirty_ranges_)
+        {
+            size += range.second - range.first;
+        }
+        
+        return size;
+    }
+    
+    void ShadowBuffer::Sync()
+    {
+        if (dirty_ranges_.empty())
+        {
+            return;
+        }
+        
+        std::vector<VkBufferCopy> regions;
+        regions.reserve(dirty_ranges_.size());
+        
+        for (auto& range : dirty_ranges_)
+        {
+            regions.push_back(VkBufferCopy{ range.first, range.first, range.second - range.first });
+        }
+        
+        memory_manager_.WriteBufferRegions(buffer_, regions, shadow_.data());
+        
+        dirty_ranges_.clear();
+    }
+}
@@ -0,0 +1,73 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_scoped_object.h"
+#include "vk_memory_manager.h"
+#include <vector>
+#include <map>
+
+namespace vkw
+{
+    // Device local buffer with a host side copy. Writes go to the shadow
+    // and mark the touched bytes dirty, Sync() uploads dirty ranges only.
+    class ShadowBuffer
+    {
+    public:
+        static VkDeviceSize constexpr kCacheLineGranularity = 64u;
+        static VkDeviceSize constexpr kPageGranularity = 4096u;
+        
+        ShadowBuffer(MemoryManager& memory_manager,
+                     VkDeviceSize size,
+                     VkBufferUsageFlags usage,
+                     VkDeviceSize granularity = kCacheLineGranularity);
+        
+        // Host shadow, call MarkDirty after modifying it directly
+        void* GetData() { return shadow_.data(); }
+        void const* GetData() const { return shadow_.data(); }
+        VkDeviceSize GetSize() const { return (VkDeviceSize)shadow_.size(); }
+        
+        // Copy into the shadow and mark the range dirty
+        void Write(VkDeviceSize offset, VkDeviceSize size, void const* data);
+        
+        // Range is widened to the tracking granularity and merged
+        // with overlapping or adjacent dirty ranges
+        void MarkDirty(VkDeviceSize offset, VkDeviceSize size);
+        
+        // Upload dirty ranges as a single multi-region copy
+        void Sync();
+        
+        // Number of bytes the next Sync() is going to upload
+        VkDeviceSize GetDirtySize() const;
+        
+        VkBuffer GetBuffer() { return buffer_; }
+        operator VkBuffer() { return buffer_; }
+        
+    private:
+        MemoryManager& memory_manager_;
+        VkScopedObject<VkBuffer> buffer_;
+        VkDeviceSize granularity_;
+        std::vector<char> shadow_;
+        // Disjoint, non-adjacent [begin, end) ranges keyed by begin
+        std::map<VkDeviceSize, VkDeviceSize> dirty_ranges_;
+    };
+}
@@ -0,0 +1,504 @@
+#include "vk_task_graph.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace vkw
+{
+    TaskGraph::TaskGraph(MemoryManager& memory_manager)
+    : memory_manager_(memory_manager)
+    {
+    }
+    
+    TaskGraph::Resource TaskGraph::ImportBuffer(VkBuffer buffer,
+                                                VkPipelineStageFlags last_write_stage,
+                                                VkAccessFlags last_write_access)
+    {
+        ResourceInfo info;
+        info.type = ResourceType::kBuffer;
+        info.buffer = buffer;
+        info.initial_write_stage = last_write_stage;
+        info.initial_write_access = last_write_access;
+        resources_.push_back(info);
+        return static_cast<Resource>(resources_.size() - 1);
+    }
+    
+    TaskGraph::Resource TaskGraph::ImportImage(VkImage image,
+                                               VkImageLayout layout,
+                                               VkImageAspectFlags aspect,
+                                               VkPipelineStageFlags last_write_stage,
+                                               VkAccessFlags last_write_access)
+    {
+        ResourceInfo info;
+        info.type = ResourceType::kImage;
+        info.image = image;
+        info.aspect = aspect;
+        info.initial_layout = layout;
+        info.final_layout = layout;
+        info.initial_write_stage = last_write_stage;
+        info.initial_write_access = last_write_access;
+        resources_.push_back(info);
+        return static_cast<Resource>(resources_.size() - 1);
+    }
+    
+    TaskGraph::Resource TaskGraph::CreateTransientBuffer(VkDeviceSize size, VkBufferUsageFlags usage)
+    {
+        ResourceInfo info;
+        info.type = ResourceType::kTransientBuffer;
+        info.size = size;
+        info.usage = usage;
+        resources_.push_back(info);
+        return static_cast<Resource>(resources_.size() - 1);
+    }
+    
+    TaskGraph::Pass TaskGraph::AddPass(RecordFunc record)
+    {
+        PassInfo info;
+        info.record = std::move(record);
+        passes_.push_back(std::move(info));
+        return static_cast<Pass>(passes_.size() - 1);
+    }
+    
+    void TaskGraph::Read(Pass pass,
+                         Resource resource,
+                         VkPipelineStageFlags stage,
+                         VkAccessFlags access,
+                         VkImageLayout layout)
+    {
+        AddAccess(pass, resource, stage, access, layout, false);
+    }
+    
+    void TaskGraph::Write(Pass pass,
+                          Resource resource,
+                          VkPipelineStageFlags stage,
+                          VkAccessFlags access,
+                          VkImageLayout layout)
+    {
+        AddAccess(pass, resource, stage, access, layout, true);
+    }
+    
+    void TaskGraph::SetSideEffects(Pass pass)
+    {
+        passes_.at(pass).side_effects = true;
+    }
+    
+    void TaskGraph::AddAccess(Pass pass,
+                              Resource resource,
+                              VkPipelineStageFlags stage,
+                              VkAccessFlags access,
+                              VkImageLayout layout,
+                              bool write)
+    {
+        if (compiled_)
+        {
+            throw std::runtime_error("TaskGraph: Graph has already been compiled");
+        }
+        
+        if (stage == 0u)
+        {
+            throw std::runtime_error("TaskGraph: Access needs a pipeline stage");
+        }
+        
+        auto& info = resources_.at(resource);
+        
+        if (info.type == ResourceType::kImage && layout == VK_IMAGE_LAYOUT_UNDEFINED)
+        {
+            throw std::runtime_error("TaskGraph: Image access needs a layout");
+        }
+        
+        auto& accesses = passes_.at(pass).accesses;
+        
+        auto iter = std::find_if(accesses.begin(), accesses.end(),
+                                 [resource](Access const& a) { return a.resource == resource; });
+        
+        if (iter == accesses.end())
+        {
+            accesses.push_back({ resource, stage, access, layout, !write, write });
+            return;
+        }
+        
+        if (info.type == ResourceType::kImage && iter->layout != layout)
+        {
+            throw std::runtime_error("TaskGraph: Image accessed with two layouts in one pass");
+        }
+        
+        iter->stage |= stage;
+        iter->access |= access;
+        iter->read = iter->read || !write;
+        iter->write = iter->write || write;
+    }
+    
+    void TaskGraph::Compile()
+    {
+        levels_.clear();
+        transient_buffers_.clear();
+        
+        for (auto& info : resources_)
+        {
+            info.physical = kInvalidIndex;
+            info.lifetime = { kInvalidIndex, 0u };
+            info.final_layout = info.initial_layout;
+        }
+        
+        CullPasses();
+        AssignLevels();
+        AllocateTransientBuffers();
+        ComputeBarriers();
+        
+        compiled_ = true;
+    }
+    
+    void TaskGraph::CullPasses()
+    {
+        // Imported resources are visible outside, transient ones only if a surviving pass reads them
+        std::vector<bool> needed(resources_.size());
+        for (auto i = 0u; i < resources_.size(); ++i)
+        {
+            needed[i] = resources_[i].type != ResourceType::kTransientBuffer;
+        }
+        
+        for (auto i = passes_.size(); i-- > 0u;)
+        {
+            auto& pass = passes_[i];
+            
+            pass.culled = !pass.side_effects;
+            
+            for (auto& access : pass.accesses)
+            {
+                if (access.write && needed[access.resource])
+                {
+                    pass.culled = false;
+                }
+            }
+            
+            if (pass.culled)
+            {
+                continue;
+            }
+            
+            for (auto& access : pass.accesses)
+            {
+                if (access.read)
+                {
+                    needed[access.resource] = true;
+                }
+            }
+        }
+    }
+    
+    void TaskGraph::AssignLevels()
+    {
+        struct Reader
+        {
+            Pass pass;
+            VkImageLayout layout;
+        };
+        
+        std::vector<std::uint32_t> last_writer(resources_.size(), kInvalidIndex);
+        std::vector<std::vector<Reader>> readers(resources_.size());
+        
+        std::uint32_t num_levels = 0u;
+        
+        // Passes only depend on earlier passes, program order is a valid topological order
+        for (auto i = 0u; i < passes_.size(); ++i)
+        {
+            auto& pass = passes_[i];
+            
+            if (pass.culled)
+            {
+                continue;
+            }
+            
+            std::uint32_t level = 0u;
+            auto depend_on = [this, &level](std::uint32_t other)
+            {
+                if (other != kInvalidIndex)
+                {
+                    level = std::max(level, passes_[other].level + 1u);
+                }
+            };
+            
+            for (auto& access : pass.accesses)
+            {
+                auto r = access.resource;
+                
+                // RAW and WAW
+                depend_on(last_writer[r]);
+                
+                if (access.write)
+                {
+                    // WAR
+                    for (auto& reader : readers[r])
+                    {
+                        depend_on(reader.pass);
+                    }
+                    
+                    last_writer[r] = i;
+                    readers[r].clear();
+                }
+                else
+                {
+                    // Reads in different layouts need a transition in between
+                    if (resources_[r].type == ResourceType::kImage)
+                    {
+                        for (auto& reader : readers[r])
+                        {
+                            if (reader.layout != access.layout)
+                            {
+                                depend_on(reader.pass);
+                            }
+                        }
+                    }
+                    
+                    readers[r].push_back({ i, access.layout });
+                }
+            }
+            
+            pass.level = level;
+            num_levels = std::max(num_levels, level + 1u);
+        }
+        
+        levels_.resize(num_levels);
+        
+        for (auto i = 0u; i < passes_.size(); ++i)
+        {
+            auto& pass = passes_[i];
+            
+            if (pass.culled)
+            {
+                continue;
+            }
+            
+            levels_[pass.level].passes.push_back(i);
+            
+            for (auto& access : pass.accesses)
+            {
+                auto& lifetime = resources_[access.resource].lifetime;
+                lifetime.first_level = std::min(lifetime.first_level, pass.level);
+                lifetime.last_level = std::max(lifetime.last_level, pass.level);
+            }
+        }
+    }
+    
+    void TaskGraph::AllocateTransientBuffers()
+    {
+        std::vector<Resource> transients;
+        for (auto i = 0u; i < resources_.size(); ++i)
+        {
+            auto& info = resources_[i];
+            if (info.type == ResourceType::kTransientBuffer && info.lifetime.first_level != kInvalidIndex)
+            {
+                transients.push_back(i);
+            }
+        }
+        
+        std::stable_sort(transients.begin(), transients.end(),
+                         [this](Resource a, Resource b)
+                         {
+                             return resources_[a].lifetime.first_level < resources_[b].lifetime.first_level;
+                         });
+        
+        for (auto r : transients)
+        {
+            auto& info = resources_[r];
+            
+            // Smallest buffer that is free by now
+            auto best = kInvalidIndex;
+            for (auto i = 0u; i < transient_buffers_.size(); ++i)
+            {
+                auto& buffer = transient_buffers_[i];
+                
+                if (buffer.last_level < info.lifetime.first_level &&
+                    buffer.size >= info.size &&
+                    (buffer.usage & info.usage) == info.usage &&
+                    (best == kInvalidIndex || buffer.size < transient_buffers_[best].size))
+                {
+                    best = i;
+                }
+            }
+            
+            if (best == kInvalidIndex)
+            {
+                TransientBuffer buffer;
+                buffer.buffer = memory_manager_.CreateBuffer(info.size,
+                                                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                             info.usage);
+                buffer.size = info.size;
+                buffer.usage = info.usage;
+                transient_buffers_.push_back(std::move(buffer));
+                best = static_cast<std::uint32_t>(transient_buffers_.size() - 1);
+            }
+            
+            transient_buffers_[best].last_level = info.lifetime.last_level;
+            info.physical = best;
+            info.buffer = transient_buffers_[best].buffer;
+        }
+    }
+    
+    void TaskGraph::ComputeBarriers()
+    {
+        // Aliased transient buffers share the state of their VkBuffer
+        auto state_index = [this](Resource r)
+        {
+            auto& info = resources_[r];
+            return info.type == ResourceType::kTransientBuffer ?
+                   resources_.size() + info.physical : static_cast<std::size_t>(r);
+        };
+        
+        std::vector<ResourceState> states(resources_.size() + transient_buffers_.size());
+        
+        for (auto i = 0u; i < resources_.size(); ++i)
+        {
+            auto& info = resources_[i];
+            
+            if (info.type != ResourceType::kTransientBuffer)
+            {
+                auto& state = states[i];
+                state.write_stage = info.initial_write_stage;
+                state.write_access = info.initial_write_access;
+                state.layout = info.initial_layout;
+            }
+        }
+        
+        for (auto& level : levels_)
+        {
+            // Passes in a level are independent: a resource is either read by
+            // several of them in the same layout or written by one
+            std::vector<Access> merged;
+            
+            for (auto p : level.passes)
+            {
+                for (auto& access : passes_[p].accesses)
+                {
+                    auto index = state_index(access.resource);
+                    auto iter = std::find_if(merged.begin(), merged.end(),
+                                             [&](Access const& a) { return state_index(a.resource) == index; });
+                    
+                    if (iter == merged.end())
+                    {
+                        merged.push_back(access);
+                    }
+                    else
+                    {
+                        iter->stage |= access.stage;
+                        iter->access |= access.access;
+                        iter->write = iter->write || access.write;
+                    }
+                }
+            }
+            
+            for (auto& access : merged)
+            {
+                auto& info = resources_[access.resource];
+                auto& state = states[state_index(access.resource)];
+                auto is_image = info.type == ResourceType::kImage;
+                
+                // Buffers stay in the undefined layout
+                auto layout = is_image ? access.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+                auto barrier = state.Access(access.stage, access.access, layout, access.write);
+                
+                if (barrier.src_stage != 0u)
+                {
+                    level.src_stage |= barrier.src_stage;
+                    level.dst_stage |= barrier.dst_stage;
+                    
+                    if (is_image)
+                    {
+                        VkImageMemoryBarrier image_barrier;
+                        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                        image_barrier.pNext = nullptr;
+                        image_barrier.srcAccessMask = barrier.src_access;
+                        image_barrier.dstAccessMask = barrier.dst_access;
+                        image_barrier.oldLayout = barrier.old_layout;
+                        image_barrier.newLayout = barrier.new_layout;
+                        image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                        image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                        image_barrier.image = info.image;
+                        image_barrier.subresourceRange.aspectMask = info.aspect;
+                        image_barrier.subresourceRange.baseMipLevel = 0u;
+                        image_barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+                        image_barrier.subresourceRange.baseArrayLayer = 0u;
+                        image_barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+                        level.image_barriers.push_back(image_barrier);
+                    }
+                    else
+                    {
+                        VkBufferMemoryBarrier buffer_barrier;
+                        buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                        buffer_barrier.pNext = nullptr;
+                        buffer_barrier.srcAccessMask = barrier.src_access;
+                        buffer_barrier.dstAccessMask = barrier.dst_access;
+                        buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                        buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                        buffer_barrier.buffer = info.buffer;
+                        buffer_barrier.offset = 0u;
+                        buffer_barrier.size = VK_WHOLE_SIZE;
+                        level.buffer_barriers.push_back(buffer_barrier);
+                    }
+                }
+                
+                if (is_image)
+                {
+                    info.final_layout = access.layout;
+                }
+            }
+        }
+    }
+    
+    void TaskGraph::Record(CommandBufferBuilder& builder)
+    {
+        if (!compiled_)
+        {
+            throw std::runtime_error("TaskGraph: Record called before Compile");
+        }
+        
+        for (auto& level : levels_)
+        {
+            if (level.src_stage != 0u)
+            {
+                builder.PipelineBarrier(level.src_stage,
+                                        level.dst_stage,
+                                        level.buffer_barriers,
+                                        level.image_barriers);
+            }
+            
+            for (auto p : level.passes)
+            {
+                passes_[p].record(builder);
+            }
+        }
+    }
+    
+    void TaskGraph::Reset()
+    {
+        resources_.clear();
+        passes_.clear();
+        levels_.clear();
+        transient_buffers_.clear();
+        compiled_ = false;
+    }
+    
+    VkBuffer TaskGraph::GetBuffer(Resource resource) const
+    {
+        return resources_.at(resource).buffer;
+    }
+    
+    VkImage TaskGraph::GetImage(Resource resource) const
+    {
+        return resources_.at(resource).image;
+    }
+    
+    VkImageLayout TaskGraph::GetFinalLayout(Resource resource) const
+    {
+        return resources_.at(resource).final_layout;
+    }
+    
+    TaskGraph::Lifetime TaskGraph::GetLifetime(Resource resource) const
+    {
+        return resources_.at(resource).lifetime;
+    }
+    
+    bool TaskGraph::IsCulled(Pass pass) const
+    {
+        return passes_.at(pass).culled;
+    }
+}
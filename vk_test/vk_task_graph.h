@@ -0,0 +1,190 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_scoped_object.h"
+#include "vk_memory_manager.h"
+#include "vk_command_buffer_builder.h"
+#include "vk_resource_state_tracker.h"
+#include <functional>
+#include <vector>
+
+namespace vkw
+{
+    // Passes declare the buffers and images they read and write, in program
+    // order. Compile culls passes whose results are never consumed, groups
+    // the rest into dependency levels and works out the barriers between
+    // levels. Passes within a level are independent and share a single
+    // vkCmdPipelineBarrier.
+    //
+    // Writes to imported resources are considered visible outside of the graph,
+    // transient buffers only live inside of it and may share a VkBuffer with
+    // other transient buffers when their lifetimes do not overlap.
+    class TaskGraph
+    {
+    public:
+        using Resource = std::uint32_t;
+        using Pass = std::uint32_t;
+        using RecordFunc = std::function<void(CommandBufferBuilder& builder)>;
+        
+        // Resource lifetime in levels of the compiled graph
+        struct Lifetime
+        {
+            std::uint32_t first_level;
+            std::uint32_t last_level;
+        };
+        
+        explicit TaskGraph(MemoryManager& memory_manager);
+        
+        // Last write to the buffer before the graph, if any, gets synchronized with its first use
+        Resource ImportBuffer(VkBuffer buffer,
+                              VkPipelineStageFlags last_write_stage = 0u,
+                              VkAccessFlags last_write_access = 0u);
+        
+        Resource ImportImage(VkImage image,
+                             VkImageLayout layout,
+                             VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT,
+                             VkPipelineStageFlags last_write_stage = 0u,
+                             VkAccessFlags last_write_access = 0u);
+        
+        // Device local buffer created on Compile, only if a pass using it survives culling
+        Resource CreateTransientBuffer(VkDeviceSize size, VkBufferUsageFlags usage);
+        
+        Pass AddPass(RecordFunc record);
+        
+        // Layout only matters for images. Reading and writing the same
+        // resource from one pass makes it a read-write access.
+        void Read(Pass pass,
+                  Resource resource,
+                  VkPipelineStageFlags stage,
+                  VkAccessFlags access,
+                  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+        
+        void Write(Pass pass,
+                   Resource resource,
+                   VkPipelineStageFlags stage,
+                   VkAccessFlags access,
+                   VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+        
+        // Keep the pass even if nothing consumes its writes
+        void SetSideEffects(Pass pass);
+        
+        void Compile();
+        
+        // Record the compiled passes with their barriers
+        void Record(CommandBufferBuilder& builder);
+        
+        // Drop passes and resources, transient buffers are destroyed so the
+        // previously recorded command buffers should have completed
+        void Reset();
+        
+        // Valid after Compile
+        VkBuffer GetBuffer(Resource resource) const;
+        VkImage GetImage(Resource resource) const;
+        // Layout the image is left in after the graph
+        VkImageLayout GetFinalLayout(Resource resource) const;
+        Lifetime GetLifetime(Resource resource) const;
+        bool IsCulled(Pass pass) const;
+        std::uint32_t GetNumLevels() const { return static_cast<std::uint32_t>(levels_.size()); }
+        
+    private:
+        static std::uint32_t constexpr kInvalidIndex = ~0u;
+        
+        enum class ResourceType
+        {
+            kBuffer,
+            kImage,
+            kTransientBuffer
+        };
+        
+        struct ResourceInfo
+        {
+            ResourceType type;
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkImage image = VK_NULL_HANDLE;
+            VkImageAspectFlags aspect = 0u;
+            VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkPipelineStageFlags initial_write_stage = 0u;
+            VkAccessFlags initial_write_access = 0u;
+            VkDeviceSize size = 0u;
+            VkBufferUsageFlags usage = 0u;
+            // Index into transient_buffers_
+            std::uint32_t physical = kInvalidIndex;
+            Lifetime lifetime = { kInvalidIndex, 0u };
+        };
+        
+        struct Access
+        {
+            Resource resource;
+            VkPipelineStageFlags stage;
+            VkAccessFlags access;
+            VkImageLayout layout;
+            bool read;
+            bool write;
+        };
+        
+        struct PassInfo
+        {
+            RecordFunc record;
+            std::vector<Access> accesses;
+            bool side_effects = false;
+            bool culled = false;
+            std::uint32_t level = 0u;
+        };
+        
+        struct Level
+        {
+            std::vector<Pass> passes;
+            VkPipelineStageFlags src_stage = 0u;
+            VkPipelineStageFlags dst_stage = 0u;
+            std::vector<VkBufferMemoryBarrier> buffer_barriers;
+            std::vector<VkImageMemoryBarrier> image_barriers;
+        };
+        
+        struct TransientBuffer
+        {
+            VkScopedObject<VkBuffer> buffer;
+            VkDeviceSize size;
+            VkBufferUsageFlags usage;
+            std::uint32_t last_level;
+        };
+        
+        void AddAccess(Pass pass,
+                       Resource resource,
+                       VkPipelineStageFlags stage,
+                       VkAccessFlags access,
+                       VkImageLayout layout,
+                       bool write);
+        void CullPasses();
+        void AssignLevels();
+        void AllocateTransientBuffers();
+        void ComputeBarriers();
+        
+        MemoryManager& memory_manager_;
+        std::vector<ResourceInfo> resources_;
+        std::vector<PassInfo> passes_;
+        std::vector<Level> levels_;
+        std::vector<TransientBuffer> transient_buffers_;
+        bool compiled_ = false;
+    };
+}
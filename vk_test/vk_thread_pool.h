@@ -0,0 +1,170 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <algorithm>
+#include <exception>
+
+namespace vkw
+{
+    // Fixed size pool of worker threads used to split
+    // host side work (copies, recording) across cores.
+    class ThreadPool
+    {
+    public:
+        // Zero means one thread per hardware core
+        explicit ThreadPool(std::size_t num_threads = 0u)
+        {
+            if (num_threads == 0u)
+            {
+                num_threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            
+            for (auto i = 0u; i < num_threads; ++i)
+            {
+                workers_.emplace_back([this]() { WorkerLoop(); });
+            }
+        }
+        
+        ~ThreadPool()
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            
+            condition_.notify_all();
+            
+            for (auto& worker : workers_)
+            {
+                worker.join();
+            }
+        }
+        
+        ThreadPool(ThreadPool const&) = delete;
+        ThreadPool& operator=(ThreadPool const&) = delete;
+        
+        std::size_t GetNumThreads() const { return workers_.size(); }
+        
+        // Enqueue task, the future is ready once the task has been executed
+        std::future<void> Submit(std::function<void()> task)
+        {
+            auto packaged_task = std::make_shared<std::packaged_task<void()>>(std::move(task));
+            auto future = packaged_task->get_future();
+            
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                tasks_.emplace_back([packaged_task]() { (*packaged_task)(); });
+            }
+            
+            condition_.notify_one();
+            return future;
+        }
+        
+        // Run func(i) for i in [0, count) and block until all of them are done.
+        // The calling thread executes the last index itself.
+        void ParallelFor(std::size_t count, std::function<void(std::size_t)> const& func)
+        {
+            if (count == 0u)
+            {
+                return;
+            }
+            
+            std::vector<std::future<void>> futures;
+            futures.reserve(count - 1);
+            
+            for (auto i = 0u; i < count - 1; ++i)
+            {
+                futures.push_back(Submit([&func, i]() { func(i); }));
+            }
+            
+            // Tasks reference func and the caller's stack, every one of them has
+            // to be done before an exception leaves this function
+            std::exception_ptr exception;
+            
+            try
+            {
+                func(count - 1);
+            }
+            catch (...)
+            {
+                exception = std::current_exception();
+            }
+            
+            for (auto& future : futures)
+            {
+                try
+                {
+                    future.get();
+                }
+                catch (...)
+                {
+                    if (!exception)
+                    {
+                        exception = std::current_exception();
+                    }
+                }
+            }
+            
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+        }
+        
+    private:
+        void WorkerLoop()
+        {
+            for (;;)
+            {
+                std::function<void()> task;
+                
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    condition_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+                    
+                    if (stop_ && tasks_.empty())
+                    {
+                        return;
+                    }
+                    
+                    task = std::move(tasks_.front());
+                    tasks_.pop_front();
+                }
+                
+                task();
+            }
+        }
+        
+        std::vector<std::thread> workers_;
+        std::deque<std::function<void()>> tasks_;
+        std::mutex mutex_;
+        std::condition_variable condition_;
+        bool stop_ = false;
+    };
+}
@@ -1,6 +1,9 @@
 
 #include "vk_utils.h"
 #include <vector>
+#include <map>
+#include <algorithm>
+#include <utility>
 
 namespace vkw
 {
@@ -32,4 +35,47 @@ namespace vkw
         return std::find(formats.begin(), formats.end(), format) != std::end(formats);
     }
 
+    void RecordBufferCopies(VkCommandBuffer command_buffer,
+                            std::vector<BufferCopyRegion> const& regions)
+    {
+        struct CopyGroup
+        {
+            VkBuffer src_buffer;
+            VkBuffer dst_buffer;
+            std::vector<VkBufferCopy> copies;
+        };
+        
+        std::vector<CopyGroup> groups;
+        std::map<std::pair<VkBuffer, VkBuffer>, std::size_t> group_indices;
+        
+        for (auto& region : regions)
+        {
+            if (region.size == 0u)
+            {
+                continue;
+            }
+            
+            auto key = std::make_pair(region.src_buffer, region.dst_buffer);
+            auto iter = group_indices.find(key);
+            
+            if (iter == group_indices.cend())
+            {
+                iter = group_indices.emplace(key, groups.size()).first;
+                groups.push_back(CopyGroup{ region.src_buffer, region.dst_buffer, {} });
+            }
+            
+            groups[iter->second].copies.push_back(VkBufferCopy{ region.src_offset,
+                                                                region.dst_offset,
+                                                                region.size });
+        }
+        
+        for (auto& group : groups)
+        {
+            vkCmdCopyBuffer(command_buffer,
+                            group.src_buffer,
+                            group.dst_buffer,
+                            (std::uint32_t)group.copies.size(),
+                            group.copies.data());
+        }
+    }
 }
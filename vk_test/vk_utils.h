@@ -23,7 +23,33 @@
 #pragma once
 #include <vulkan/vulkan.h>
 
+#include <vector>
+
 namespace vkw {
     bool ContainsDepth(VkFormat format);
     bool ContainsStencil(VkFormat format);
+    
+    // Single region of a device to device copy
+    struct BufferCopyRegion
+    {
+        VkBuffer src_buffer;
+        VkBuffer dst_buffer;
+        VkDeviceSize src_offset;
+        VkDeviceSize dst_offset;
+        VkDeviceSize size;
+    };
+    
+    // Field of array-of-structs records written packed to its own buffer range
+    struct BufferFieldRegion
+    {
+        VkDeviceSize record_offset;
+        VkDeviceSize size;
+        VkBuffer dst_buffer;
+        VkDeviceSize dst_offset;
+    };
+    
+    // Record regions grouped per (src, dst) buffer pair, one vkCmdCopyBuffer
+    // per pair, pairs are issued in order of their first appearance.
+    void RecordBufferCopies(VkCommandBuffer command_buffer,
+                            std::vector<BufferCopyRegion> const& regions);
 }